@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "backend.hpp"
+
+#include <fcntl.h>
+#include <mtd/mtd-user.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Program granularity assumed when the device reports a smaller one */
+constexpr uint32_t HIOMAP_BACKEND_PAGE_SIZE = 256;
+
+static int hiomap_backend_find(const char* name, char* path, size_t len)
+{
+    char line[128];
+    char label[64];
+    int rc = -ENODEV;
+    int index;
+
+    FILE* mtd = fopen("/proc/mtd", "re");
+    if (!mtd)
+    {
+        return -errno;
+    }
+
+    /* dev:    size   erasesize  name */
+    while (fgets(line, sizeof(line), mtd))
+    {
+        if (sscanf(line, "mtd%d: %*x %*x \"%63[^\"]\"", &index, label) != 2)
+        {
+            continue;
+        }
+
+        if (!strcmp(label, name))
+        {
+            snprintf(path, len, "/dev/mtd%d", index);
+            rc = 0;
+            break;
+        }
+    }
+
+    fclose(mtd);
+
+    return rc;
+}
+
+int hiomap_backend_open(struct hiomap_backend* backend, const char* name)
+{
+    struct mtd_info_user info;
+    char path[32];
+    int rc;
+
+    backend->fd = -1;
+
+    rc = hiomap_backend_find(name, path, sizeof(path));
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (ioctl(fd, MEMGETINFO, &info) < 0)
+    {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    backend->fd = fd;
+    backend->size = info.size;
+    backend->erase_size = info.erasesize;
+    backend->page_size = std::max<uint32_t>(info.writesize,
+                                            HIOMAP_BACKEND_PAGE_SIZE);
+
+    return 0;
+}
+
+void hiomap_backend_close(struct hiomap_backend* backend)
+{
+    if (backend->fd >= 0)
+    {
+        close(backend->fd);
+        backend->fd = -1;
+    }
+}
+
+int hiomap_backend_read(struct hiomap_backend* backend, uint32_t offset,
+                        void* buf, size_t len)
+{
+    uint8_t* cursor = static_cast<uint8_t*>(buf);
+
+    if (offset > backend->size || len > backend->size - offset)
+    {
+        return -EINVAL;
+    }
+
+    while (len)
+    {
+        ssize_t rc = pread(backend->fd, cursor, len, offset);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -errno;
+        }
+
+        if (rc == 0)
+        {
+            return -EIO;
+        }
+
+        cursor += rc;
+        offset += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Erased NOR flash reads as all-ones, so programming such a page is a no-op.
+ * Compare a vector's worth at a time, which the compiler lowers to NEON or
+ * SSE.
+ */
+static bool hiomap_backend_is_erased(const uint8_t* buf, size_t len)
+{
+    typedef uint64_t vec __attribute__((vector_size(16)));
+    vec acc = {~0ULL, ~0ULL};
+    size_t i = 0;
+
+    for (; i + sizeof(vec) <= len; i += sizeof(vec))
+    {
+        vec v;
+        std::memcpy(&v, buf + i, sizeof(v));
+        acc &= v;
+    }
+
+    for (; i < len; i++)
+    {
+        if (buf[i] != 0xff)
+        {
+            return false;
+        }
+    }
+
+    return (acc[0] & acc[1]) == ~0ULL;
+}
+
+static int hiomap_backend_erase(struct hiomap_backend* backend,
+                                uint32_t offset, uint32_t len)
+{
+    struct erase_info_user erase = {offset, len};
+
+    if (ioctl(backend->fd, MEMERASE, &erase) < 0)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int hiomap_backend_program(struct hiomap_backend* backend,
+                                  uint32_t offset, const uint8_t* buf,
+                                  size_t len)
+{
+    while (len)
+    {
+        ssize_t rc = pwrite(backend->fd, buf, len, offset);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -errno;
+        }
+
+        buf += rc;
+        offset += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/* Program a freshly erased block, skipping pages that are all-ones */
+static int hiomap_backend_program_block(struct hiomap_backend* backend,
+                                        uint32_t offset, const uint8_t* buf)
+{
+    uint32_t run = 0;
+    uint32_t i;
+    int rc;
+
+    /* Coalesce runs of pages that need programming into one write */
+    for (i = 0; i < backend->erase_size; i += backend->page_size)
+    {
+        if (!hiomap_backend_is_erased(buf + i, backend->page_size))
+        {
+            backend->pages_programmed++;
+            run += backend->page_size;
+            continue;
+        }
+
+        backend->pages_skipped++;
+
+        if (run)
+        {
+            rc = hiomap_backend_program(backend, offset + i - run,
+                                        buf + i - run, run);
+            if (rc < 0)
+            {
+                return rc;
+            }
+
+            run = 0;
+        }
+    }
+
+    if (run)
+    {
+        return hiomap_backend_program(backend, offset + i - run,
+                                      buf + i - run, run);
+    }
+
+    return 0;
+}
+
+void hiomap_backend_set_rmw_capacity(struct hiomap_backend* backend,
+                                     size_t blocks)
+{
+    backend->rmw_capacity = blocks;
+
+    while (backend->rmw_cache.size() > blocks)
+    {
+        hiomap_budget_release(&backend->rmw_budget,
+                              backend->rmw_cache.back().data.size());
+        backend->rmw_cache.pop_back();
+    }
+}
+
+void hiomap_backend_reclaim(struct hiomap_backend* backend, uint64_t bytes)
+{
+    uint64_t freed = 0;
+
+    while (freed < bytes && !backend->rmw_cache.empty())
+    {
+        freed += backend->rmw_cache.back().data.size();
+        hiomap_budget_release(&backend->rmw_budget,
+                              backend->rmw_cache.back().data.size());
+        backend->rmw_cache.pop_back();
+    }
+}
+
+void hiomap_backend_invalidate(struct hiomap_backend* backend, uint32_t offset,
+                               uint32_t len)
+{
+    uint64_t end = uint64_t(offset) + len;
+
+    backend->rmw_cache.remove_if([=](const struct hiomap_rmw_block& block) {
+        bool overlaps =
+            block.offset < end && offset < block.offset + block.data.size();
+
+        if (overlaps)
+        {
+            hiomap_budget_release(&backend->rmw_budget, block.data.size());
+        }
+
+        return overlaps;
+    });
+}
+
+/* Fetch the current contents of the erase block at base into block */
+static int hiomap_backend_rmw_fetch(struct hiomap_backend* backend,
+                                    uint32_t base, std::vector<uint8_t>& block)
+{
+    auto& cache = backend->rmw_cache;
+
+    for (auto it = cache.begin(); it != cache.end(); ++it)
+    {
+        if (it->offset == base)
+        {
+            backend->rmw_hits++;
+            block = it->data;
+            cache.splice(cache.begin(), cache, it);
+            return 0;
+        }
+    }
+
+    backend->rmw_misses++;
+
+    return hiomap_backend_read(backend, base, block.data(),
+                               backend->erase_size);
+}
+
+/* Remember what we wrote to the erase block at base */
+static void hiomap_backend_rmw_store(struct hiomap_backend* backend,
+                                     uint32_t base,
+                                     const std::vector<uint8_t>& block)
+{
+    auto& cache = backend->rmw_cache;
+
+    if (!backend->rmw_capacity)
+    {
+        return;
+    }
+
+    for (auto it = cache.begin(); it != cache.end(); ++it)
+    {
+        if (it->offset == base)
+        {
+            it->data = block;
+            cache.splice(cache.begin(), cache, it);
+            return;
+        }
+    }
+
+    if (cache.size() >= backend->rmw_capacity)
+    {
+        /* Recycle the least recently used entry's buffer */
+        cache.splice(cache.begin(), cache, std::prev(cache.end()));
+        cache.front().offset = base;
+        cache.front().data = block;
+        return;
+    }
+
+    /* Under memory pressure, do without */
+    if (!hiomap_budget_charge(&backend->rmw_budget, block.size()))
+    {
+        return;
+    }
+
+    cache.push_front({base, block});
+}
+
+/* Read back the erase block at base and check it holds what we programmed */
+static int hiomap_backend_verify_block(struct hiomap_backend* backend,
+                                       uint32_t base, const uint8_t* expected)
+{
+    std::vector<uint8_t> actual(backend->erase_size);
+
+    int rc = hiomap_backend_read(backend, base, actual.data(), actual.size());
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    if (std::memcmp(actual.data(), expected, actual.size()))
+    {
+        backend->verify_failures++;
+        return -EIO;
+    }
+
+    return 0;
+}
+
+int hiomap_backend_writeback_range(
+    struct hiomap_backend* backend,
+    const std::vector<struct hiomap_backend_op>& ops, uint32_t range_base,
+    uint32_t range_len)
+{
+    uint32_t erase_size = backend->erase_size;
+    uint64_t range_end = uint64_t(range_base) + range_len;
+    int rc;
+
+    if (!hiomap_backend_ready(backend))
+    {
+        return -ENODEV;
+    }
+
+    if (range_base % erase_size || range_len % erase_size ||
+        range_end > backend->size)
+    {
+        return -EINVAL;
+    }
+
+    for (const auto& op : ops)
+    {
+        if (op.offset > backend->size || op.len > backend->size - op.offset)
+        {
+            return -EINVAL;
+        }
+    }
+
+    /* Build the new contents of each affected erase block, by address */
+    std::map<uint32_t, std::vector<uint8_t>> blocks;
+    std::map<uint32_t, std::vector<uint8_t>> original;
+
+    for (const auto& op : ops)
+    {
+        uint64_t op_end = uint64_t(op.offset) + op.len;
+
+        if (op_end <= range_base || op.offset >= range_end)
+        {
+            continue;
+        }
+
+        /* Only the part of the op within the range */
+        uint32_t offset = std::max(op.offset, range_base);
+        uint32_t len = std::min(op_end, range_end) - offset;
+        const uint8_t* src = op.data ? op.data + (offset - op.offset) : NULL;
+
+        while (len)
+        {
+            uint32_t base = offset - offset % erase_size;
+            uint32_t start = offset - base;
+            uint32_t chunk = std::min(len, erase_size - start);
+
+            auto it = blocks.find(base);
+            if (it == blocks.end())
+            {
+                it = blocks.emplace(base, std::vector<uint8_t>(erase_size))
+                         .first;
+
+                /*
+                 * Preserve the parts of the block the caller didn't supply,
+                 * and see whether the block needs writing at all
+                 */
+                rc = hiomap_backend_rmw_fetch(backend, base, it->second);
+                if (rc < 0)
+                {
+                    return rc;
+                }
+
+                original.emplace(base, it->second);
+            }
+
+            if (src)
+            {
+                std::memcpy(it->second.data() + start, src, chunk);
+                src += chunk;
+            }
+            else
+            {
+                std::memset(it->second.data() + start, op.fill, chunk);
+            }
+
+            offset += chunk;
+            len -= chunk;
+        }
+    }
+
+    /* Rewriting a block with what it already holds only wears it */
+    for (auto it = blocks.begin(); it != blocks.end();)
+    {
+        if (it->second == original[it->first])
+        {
+            backend->blocks_unchanged++;
+            it = blocks.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    /*
+     * Walk the blocks in ascending order. Contiguous blocks are erased with a
+     * single command, which lets the driver use its larger erase opcodes.
+     */
+    auto it = blocks.begin();
+    while (it != blocks.end())
+    {
+        uint32_t base = it->first;
+        uint32_t len = 0;
+        auto end = it;
+
+        while (end != blocks.end() && end->first == base + len)
+        {
+            len += erase_size;
+            ++end;
+        }
+
+        /* Whatever happens next, the cached contents are no longer valid */
+        hiomap_backend_invalidate(backend, base, len);
+
+        rc = hiomap_backend_erase(backend, base, len);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        backend->erases++;
+
+        for (; it != end; ++it)
+        {
+            rc = hiomap_backend_program_block(backend, it->first,
+                                              it->second.data());
+            if (rc < 0)
+            {
+                return rc;
+            }
+
+            backend->blocks_rewritten++;
+
+            if (backend->verify)
+            {
+                rc = hiomap_backend_verify_block(backend, it->first,
+                                                 it->second.data());
+                if (rc < 0)
+                {
+                    return rc;
+                }
+            }
+
+            hiomap_backend_rmw_store(backend, it->first, it->second);
+        }
+    }
+
+    return 0;
+}
+
+int hiomap_backend_writeback(struct hiomap_backend* backend,
+                             const std::vector<struct hiomap_backend_op>& ops)
+{
+    return hiomap_backend_writeback_range(backend, ops, 0, backend->size);
+}
+
+int hiomap_backend_write(struct hiomap_backend* backend, uint32_t offset,
+                         const void* buf, size_t len)
+{
+    if (offset > backend->size || len > backend->size - offset)
+    {
+        return -EINVAL;
+    }
+
+    return hiomap_backend_writeback(
+        backend, {{offset, static_cast<uint32_t>(len),
+                   static_cast<const uint8_t*>(buf)}});
+}
+
+} // namespace flash
+} // namespace openpower
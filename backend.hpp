@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_BACKEND_H
+#define HIOMAP_BACKEND_H
+
+#include "budget.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Full contents of an erase block we recently wrote */
+struct hiomap_rmw_block
+{
+    uint32_t offset;
+    std::vector<uint8_t> data;
+};
+
+/*
+ * Direct access to the host flash MTD device, for work the provider does
+ * without going through hiomapd: loading the shadow, and the OEM read, write
+ * and delta commands. Host windows are loaded and flushed by hiomapd from
+ * its own reserved memory, which the provider cannot see, so none of that
+ * passes through here.
+ */
+struct hiomap_backend
+{
+    int fd;
+    /* Geometry in bytes */
+    uint32_t size;
+    uint32_t erase_size;
+    uint32_t page_size;
+
+    /*
+     * Program pages written out, and those skipped as already erased, by
+     * OEM writes and deltas. hiomapd programs the host's own flushes.
+     */
+    uint64_t pages_programmed;
+    uint64_t pages_skipped;
+    /* Erase commands issued, each covering one or more erase blocks */
+    uint64_t erases;
+    /* Erase blocks rewritten, and those written with what they held */
+    uint64_t blocks_rewritten;
+    uint64_t blocks_unchanged;
+
+    /*
+     * Read back and compare each block after programming it. Covers the
+     * provider's own writes, not host Flushes handled by hiomapd.
+     */
+    bool verify;
+    uint64_t verify_failures;
+
+    /*
+     * Erase blocks kept after a write so that further partial writes to them
+     * need not read the rest of the block back. Most recently used first.
+     * OEM writes to NVRAM-style partitions are the repeat partial writers.
+     */
+    std::list<struct hiomap_rmw_block> rmw_cache;
+    size_t rmw_capacity;
+    struct hiomap_budget_client rmw_budget;
+    uint64_t rmw_hits;
+    uint64_t rmw_misses;
+};
+
+/*
+ * Open the MTD partition labelled name in /proc/mtd.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_backend_open(struct hiomap_backend* backend, const char* name);
+
+void hiomap_backend_close(struct hiomap_backend* backend);
+
+static inline bool hiomap_backend_ready(const struct hiomap_backend* backend)
+{
+    return backend->fd >= 0;
+}
+
+/* Returns 0 on success or a negative errno */
+int hiomap_backend_read(struct hiomap_backend* backend, uint32_t offset,
+                        void* buf, size_t len);
+
+/*
+ * A range to write back. A null data pointer fills the range with the fill
+ * byte instead, which by default erases it to all-ones.
+ */
+struct hiomap_backend_op
+{
+    uint32_t offset;
+    uint32_t len;
+    const uint8_t* data;
+    uint8_t fill = 0xff;
+};
+
+/*
+ * Apply ops with the same result as performing them in turn, but touching
+ * each erase block once and working through flash in ascending order. Blocks
+ * the ops leave as they were are not touched at all. OEM writes and deltas
+ * come through here; the host's Flush is handed to hiomapd.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_backend_writeback(struct hiomap_backend* backend,
+                             const std::vector<struct hiomap_backend_op>& ops);
+
+/*
+ * As hiomap_backend_writeback(), but only for the parts of ops within
+ * [base, base + len), which must start and end on erase block boundaries.
+ * Twice len bytes are needed while it runs, so callers with large ops can
+ * bound their memory by working through flash a range at a time.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_backend_writeback_range(
+    struct hiomap_backend* backend,
+    const std::vector<struct hiomap_backend_op>& ops, uint32_t base,
+    uint32_t len);
+
+/*
+ * Write buf to flash at offset, erasing the affected erase blocks and
+ * preserving any parts of them outside the range.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_backend_write(struct hiomap_backend* backend, uint32_t offset,
+                         const void* buf, size_t len);
+
+/* Limit the read-modify-write cache to the given number of erase blocks */
+void hiomap_backend_set_rmw_capacity(struct hiomap_backend* backend,
+                                     size_t blocks);
+
+/* Drop least recently used cached blocks until bytes have been freed */
+void hiomap_backend_reclaim(struct hiomap_backend* backend, uint64_t bytes);
+
+/* Forget cached contents overlapping a range modified by someone else */
+void hiomap_backend_invalidate(struct hiomap_backend* backend, uint32_t offset,
+                               uint32_t len);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_BACKEND_H */
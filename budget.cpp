@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "budget.hpp"
+
+#include "settings.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace openpower
+{
+namespace flash
+{
+
+uint64_t hiomap_budget_used(const struct hiomap_budget* budget)
+{
+    uint64_t used = 0;
+
+    for (const auto client : budget->clients)
+    {
+        used += client->used;
+    }
+
+    return used;
+}
+
+/* Evict clients below priority until bytes more would fit. Call locked. */
+static void hiomap_budget_evict(struct hiomap_budget* budget,
+                                enum hiomap_budget_priority below,
+                                uint64_t bytes)
+{
+    uint64_t limit = budget->limit;
+
+    for (auto victim : budget->clients)
+    {
+        uint64_t used = hiomap_budget_used(budget);
+
+        if (used + bytes <= limit || victim->priority >= below)
+        {
+            break;
+        }
+
+        if (victim->reclaim)
+        {
+            victim->reclaim(used + bytes - limit);
+        }
+    }
+}
+
+bool hiomap_budget_charge(struct hiomap_budget_client* client, uint64_t bytes)
+{
+    struct hiomap_budget* budget = client->budget;
+
+    if (!budget)
+    {
+        client->used += bytes;
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(budget->lock);
+    uint64_t limit = budget->limit;
+
+    if (limit)
+    {
+        hiomap_budget_evict(budget, client->priority, bytes);
+
+        if (hiomap_budget_used(budget) + bytes > limit)
+        {
+            return false;
+        }
+    }
+
+    client->used += bytes;
+
+    return true;
+}
+
+void hiomap_budget_set_limit(struct hiomap_budget* budget, uint64_t limit)
+{
+    std::lock_guard<std::mutex> guard(budget->lock);
+
+    budget->limit = limit;
+    if (limit)
+    {
+        /* Everyone is fair game, the highest priority last */
+        for (auto victim : budget->clients)
+        {
+            uint64_t used = hiomap_budget_used(budget);
+
+            if (used <= limit)
+            {
+                break;
+            }
+
+            if (victim->reclaim)
+            {
+                victim->reclaim(used - limit);
+            }
+        }
+    }
+}
+
+void hiomap_budget_register(struct hiomap_budget* budget,
+                            struct hiomap_budget_client* client,
+                            const char* name,
+                            enum hiomap_budget_priority priority,
+                            std::function<void(uint64_t bytes)> reclaim)
+{
+    std::lock_guard<std::mutex> guard(budget->lock);
+
+    client->budget = budget;
+    client->name = name;
+    client->priority = priority;
+    client->reclaim = reclaim;
+
+    auto pos = std::upper_bound(
+        budget->clients.begin(), budget->clients.end(), client,
+        [](const struct hiomap_budget_client* a,
+           const struct hiomap_budget_client* b) {
+            return a->priority < b->priority;
+        });
+    budget->clients.insert(pos, client);
+}
+
+static int hiomap_budget_get_property(sd_bus* bus, const char* path,
+                                      const char* interface,
+                                      const char* property,
+                                      sd_bus_message* reply, void* userdata,
+                                      sd_bus_error* error)
+{
+    auto budget = static_cast<struct hiomap_budget*>(userdata);
+    uint64_t value;
+    int rc;
+
+    if (!strcmp(property, "Limit"))
+    {
+        value = budget->limit;
+        return sd_bus_message_append_basic(reply, 't', &value);
+    }
+
+    if (!strcmp(property, "Used"))
+    {
+        value = hiomap_budget_used(budget);
+        return sd_bus_message_append_basic(reply, 't', &value);
+    }
+
+    if (strcmp(property, "Usage"))
+    {
+        return -ENOENT;
+    }
+
+    rc = sd_bus_message_open_container(reply, 'a', "{st}");
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    for (const auto client : budget->clients)
+    {
+        rc = sd_bus_message_append(reply, "{st}", client->name,
+                                   uint64_t(client->used));
+        if (rc < 0)
+        {
+            return rc;
+        }
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+void hiomap_budget_init(struct hiomap_budget* budget, sdbusplus::bus::bus& bus,
+                        uint64_t limit)
+{
+    using namespace sdbusplus;
+
+    budget->limit = limit;
+
+    budget->vtable.push_back(vtable::start());
+    budget->vtable.push_back(vtable::property(
+        "Limit", "t", hiomap_budget_get_property, vtable::property_::none));
+    budget->vtable.push_back(vtable::property(
+        "Used", "t", hiomap_budget_get_property, vtable::property_::none));
+    budget->vtable.push_back(vtable::property(
+        "Usage", "a{st}", hiomap_budget_get_property, vtable::property_::none));
+    budget->vtable.push_back(vtable::end());
+
+    budget->iface = std::make_unique<server::interface::interface>(
+        bus, HIOMAP_SETTINGS_OBJECT, HIOMAP_MEMORY_IFACE,
+        budget->vtable.data(), budget);
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_BUDGET_H
+#define HIOMAP_BUDGET_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+constexpr auto HIOMAP_MEMORY_IFACE = "org.open_power.Hiomap.Memory";
+
+/* Consumers are evicted lowest priority first */
+enum hiomap_budget_priority
+{
+    HIOMAP_BUDGET_PRIO_SHADOW,
+    HIOMAP_BUDGET_PRIO_RMW,
+    /* A delta can't be dropped once received, only refused */
+    HIOMAP_BUDGET_PRIO_DELTA,
+};
+
+struct hiomap_budget;
+
+/* A cache that allocates from the budget */
+struct hiomap_budget_client
+{
+    struct hiomap_budget* budget;
+    const char* name;
+    enum hiomap_budget_priority priority;
+    std::atomic<uint64_t> used;
+
+    /*
+     * Free at least the given number of bytes if possible, releasing them
+     * from the budget. Runs on the thread making the charge that needs the
+     * space, but only for clients of lower priority than the charger, or
+     * from the main loop when the limit is lowered.
+     */
+    std::function<void(uint64_t bytes)> reclaim;
+};
+
+/*
+ * One memory limit shared by all of the provider's caches, so that turning
+ * caching up cannot push the BMC into the OOM killer's sights.
+ */
+struct hiomap_budget
+{
+    /* Serialises charges and the evictions they cause */
+    std::mutex lock;
+    /* In bytes, 0 for no limit */
+    std::atomic<uint64_t> limit;
+    /* In ascending order of priority */
+    std::vector<struct hiomap_budget_client*> clients;
+
+    std::vector<sdbusplus::vtable::vtable_t> vtable;
+    std::unique_ptr<sdbusplus::server::interface::interface> iface;
+};
+
+/* Expose the per-cache usage breakdown on the bus */
+void hiomap_budget_init(struct hiomap_budget* budget, sdbusplus::bus::bus& bus,
+                        uint64_t limit);
+
+void hiomap_budget_register(struct hiomap_budget* budget,
+                            struct hiomap_budget_client* client,
+                            const char* name,
+                            enum hiomap_budget_priority priority,
+                            std::function<void(uint64_t bytes)> reclaim);
+
+/*
+ * Account for bytes about to be allocated by client, evicting from lower
+ * priority clients to make room. A client not registered with a budget is
+ * only counted.
+ *
+ * Returns false if the allocation would exceed the limit.
+ */
+bool hiomap_budget_charge(struct hiomap_budget_client* client, uint64_t bytes);
+
+/* Account for bytes freed by client. Safe under the client's own locks. */
+static inline void hiomap_budget_release(struct hiomap_budget_client* client,
+                                         uint64_t bytes)
+{
+    client->used -= bytes;
+}
+
+/* Change the limit, evicting as needed to get under it */
+void hiomap_budget_set_limit(struct hiomap_budget* budget, uint64_t limit);
+
+uint64_t hiomap_budget_used(const struct hiomap_budget* budget);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_BUDGET_H */
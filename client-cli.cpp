@@ -0,0 +1,819 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "client.hpp"
+
+#include <endian.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+/*
+ * hiomap-client: drives the provider the way a host would, for exercising it
+ * by hand, generating load and checking conformance.
+ */
+
+using namespace openpower::flash;
+
+struct hiomap_cli_options
+{
+    const char* socket;
+    bool local;
+    const char* lpc_path;
+    uint32_t lpc_base;
+    size_t lpc_size;
+
+    /* load */
+    uint64_t ops;
+    uint32_t size;
+    uint32_t start;
+    uint32_t span;
+    unsigned writes;
+    bool sequential;
+    uint32_t seed;
+
+    /* check */
+    bool have_scratch;
+    uint32_t scratch;
+};
+
+static void hiomap_cli_usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]... COMMAND [ARG]...\n"
+            "\n"
+            "Commands:\n"
+            "  info                      Print the protocol parameters\n"
+            "  read OFFSET LEN [FILE]    Read flash to FILE or stdout\n"
+            "  write OFFSET FILE         Write FILE to flash\n"
+            "  erase OFFSET LEN          Erase a block-aligned range\n"
+            "  diff OFFSET OLD NEW DELTA Write the delta from OLD to NEW, an\n"
+            "                            image of flash at OFFSET, to DELTA\n"
+            "  patch DELTA               Have the BMC apply DELTA to flash\n"
+            "  load                      Generate load and report latency\n"
+            "  check                     Check protocol conformance\n"
+            "\n"
+            "Transport:\n"
+            "  -s, --socket PATH         hiomap-socketd socket (default %s)\n"
+            "  -L, --local               Run the protocol core in-process\n"
+            "\n"
+            "LPC FW space emulation:\n"
+            "  -m, --lpc-file PATH       File or device backing the space\n"
+            "  -b, --lpc-base ADDR       LPC address of its start\n"
+            "  -z, --lpc-size BYTES      Size to map, default the whole file\n"
+            "\n"
+            "Load:\n"
+            "  -n, --ops N               Operations to issue (default 1000)\n"
+            "  -S, --size BYTES          Bytes per operation (default 4096)\n"
+            "  -o, --start OFFSET        Start of the region to use\n"
+            "  -r, --span BYTES          Size of the region to use\n"
+            "  -w, --writes PERCENT      Share of writes (default 0)\n"
+            "  -q, --sequential          Walk the region instead of seeking\n"
+            "  -e, --seed N              Random seed\n"
+            "\n"
+            "Check:\n"
+            "  -x, --scratch OFFSET      Erase block to use for write checks,\n"
+            "                            restored afterwards\n",
+            name, HIOMAP_SOCKET_PATH);
+}
+
+static int hiomap_cli_info(struct hiomap_client* client)
+{
+    printf("version: %u\n", client->version);
+    printf("block size: %u\n", 1U << client->block_size_shift);
+    printf("timeout: %us\n", client->timeout);
+    printf("flash size: %u\n", client->flash_size);
+    printf("erase size: %u\n", client->erase_size);
+    printf("events: 0x%02x\n", client->bmc_events);
+
+    return 0;
+}
+
+static int hiomap_cli_read(struct hiomap_client* client, uint32_t offset,
+                           size_t len, const char* path)
+{
+    std::vector<uint8_t> buf(len);
+
+    int rc = hiomap_client_read(client, offset, buf.data(), len);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Read failed: %s\n", strerror(-rc));
+        return rc;
+    }
+
+    FILE* out = path ? fopen(path, "wb") : stdout;
+    if (!out)
+    {
+        perror(path);
+        return -errno;
+    }
+
+    rc = fwrite(buf.data(), 1, len, out) == len ? 0 : -EIO;
+
+    if (path)
+    {
+        fclose(out);
+    }
+
+    return rc;
+}
+
+static int hiomap_cli_slurp(const char* path, std::vector<uint8_t>& buf)
+{
+    uint8_t chunk[4096];
+    size_t n;
+
+    FILE* in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return -errno;
+    }
+
+    while ((n = fread(chunk, 1, sizeof(chunk), in)))
+    {
+        buf.insert(buf.end(), chunk, chunk + n);
+    }
+
+    fclose(in);
+
+    return 0;
+}
+
+static int hiomap_cli_write(struct hiomap_client* client, uint32_t offset,
+                            const char* path)
+{
+    std::vector<uint8_t> buf;
+
+    int rc = hiomap_cli_slurp(path, buf);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    rc = hiomap_client_write(client, offset, buf.data(), buf.size());
+    if (rc < 0)
+    {
+        fprintf(stderr, "Write failed: %s\n", strerror(-rc));
+    }
+
+    return rc;
+}
+
+static void hiomap_cli_delta_record(std::vector<uint8_t>& delta, uint8_t op,
+                                    uint32_t offset, uint32_t len)
+{
+    uint8_t header[9];
+
+    offset = htole32(offset);
+    len = htole32(len);
+
+    header[0] = op;
+    memcpy(&header[1], &offset, sizeof(offset));
+    memcpy(&header[5], &len, sizeof(len));
+    delta.insert(delta.end(), header, header + sizeof(header));
+}
+
+/*
+ * Describe the runs of bytes that differ, merging runs separated by less
+ * than a record header's worth of unchanged bytes, up to the length the BMC
+ * accepts in one record
+ */
+static int hiomap_cli_diff(uint32_t offset, const char* old_path,
+                           const char* new_path, const char* delta_path)
+{
+    std::vector<uint8_t> old_image, new_image, delta;
+    const size_t gap = 9;
+    int rc;
+
+    if ((rc = hiomap_cli_slurp(old_path, old_image)) < 0 ||
+        (rc = hiomap_cli_slurp(new_path, new_image)) < 0)
+    {
+        return rc;
+    }
+
+    if (old_image.size() != new_image.size())
+    {
+        fprintf(stderr, "Images differ in size\n");
+        return -EINVAL;
+    }
+
+    size_t size = new_image.size();
+    size_t i = 0;
+
+    while (i < size)
+    {
+        if (old_image[i] == new_image[i])
+        {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        size_t end = i + 1;
+
+        size_t limit = std::min<size_t>(size, start + HIOMAP_DELTA_RECORD_MAX);
+
+        for (size_t j = end; j < limit && j < end + gap; j++)
+        {
+            if (old_image[j] != new_image[j])
+            {
+                end = j + 1;
+            }
+        }
+
+        const uint8_t* run = &new_image[start];
+        size_t len = end - start;
+        bool uniform =
+            std::all_of(run, run + len, [=](uint8_t b) { return b == run[0]; });
+
+        if (uniform && len > 1)
+        {
+            hiomap_cli_delta_record(delta, HIOMAP_DELTA_FILL, offset + start,
+                                    len);
+            delta.push_back(run[0]);
+        }
+        else
+        {
+            hiomap_cli_delta_record(delta, HIOMAP_DELTA_DATA, offset + start,
+                                    len);
+            delta.insert(delta.end(), run, run + len);
+        }
+
+        i = end;
+    }
+
+    FILE* out = fopen(delta_path, "wb");
+    if (!out)
+    {
+        perror(delta_path);
+        return -errno;
+    }
+
+    rc = fwrite(delta.data(), 1, delta.size(), out) == delta.size() ? 0 : -EIO;
+    fclose(out);
+
+    printf("delta: %zu bytes for %zu byte image\n", delta.size(), size);
+
+    return rc;
+}
+
+static int hiomap_cli_patch(struct hiomap_client* client, const char* path)
+{
+    std::vector<uint8_t> delta;
+    uint16_t rewritten, unchanged;
+
+    int rc = hiomap_cli_slurp(path, delta);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    rc = hiomap_client_patch(client, delta.data(), delta.size(), &rewritten,
+                             &unchanged);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Patch failed: %s\n", strerror(-rc));
+        return rc;
+    }
+
+    printf("erase blocks rewritten: %u\n", rewritten);
+    printf("erase blocks unchanged: %u\n", unchanged);
+
+    return 0;
+}
+
+static void hiomap_cli_report(const char* name,
+                              const struct hiomap_histogram* hist,
+                              uint64_t errors)
+{
+    printf("%-22s %8llu %6llu %10llu %10llu %10llu\n", name,
+           (unsigned long long)hist->count, (unsigned long long)errors,
+           (unsigned long long)hiomap_histogram_quantile(hist, 0.5),
+           (unsigned long long)hiomap_histogram_quantile(hist, 0.9),
+           (unsigned long long)hiomap_histogram_quantile(hist, 0.99));
+}
+
+static int hiomap_cli_load(struct hiomap_client* client,
+                           const struct hiomap_cli_options* opts)
+{
+    struct hiomap_histogram reads = {};
+    struct hiomap_histogram writes = {};
+    uint64_t read_errors = 0;
+    uint64_t write_errors = 0;
+    uint32_t span = opts->span ? opts->span : client->flash_size - opts->start;
+    uint32_t pos = 0;
+
+    if (opts->start >= client->flash_size || !opts->size ||
+        span > client->flash_size - opts->start || opts->size > span)
+    {
+        fprintf(stderr, "Load region is outside the flash\n");
+        return -EINVAL;
+    }
+
+    std::mt19937 rng(opts->seed);
+    std::uniform_int_distribution<uint32_t> where(0, span - opts->size);
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::vector<uint8_t> buf(opts->size);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < opts->ops; i++)
+    {
+        bool write = percent(rng) < opts->writes;
+        uint32_t offset;
+
+        if (opts->sequential)
+        {
+            if (pos + opts->size > span)
+            {
+                pos = 0;
+            }
+
+            offset = opts->start + pos;
+            pos += opts->size;
+        }
+        else
+        {
+            offset = opts->start + where(rng);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        int rc;
+
+        if (write)
+        {
+            std::generate(buf.begin(), buf.end(), std::ref(rng));
+            rc = hiomap_client_write(client, offset, buf.data(), buf.size());
+        }
+        else
+        {
+            rc = hiomap_client_read(client, offset, buf.data(), buf.size());
+        }
+
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+
+        hiomap_histogram_record(write ? &writes : &reads, us);
+        if (rc < 0)
+        {
+            (write ? write_errors : read_errors)++;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+
+    printf("%llu operations in %.3fs: %.1f ops/s, %.2f MiB/s\n",
+           (unsigned long long)opts->ops, elapsed, opts->ops / elapsed,
+           opts->ops * double(opts->size) / elapsed / (1 << 20));
+    printf("\n%-22s %8s %6s %10s %10s %10s\n", "operation", "count", "errors",
+           "p50 (us)", "p90 (us)", "p99 (us)");
+    hiomap_cli_report("read", &reads, read_errors);
+    hiomap_cli_report("write", &writes, write_errors);
+
+    printf("\n");
+    for (size_t cmd = 0; cmd < client->stats.commands.size(); cmd++)
+    {
+        const struct hiomap_command_stats* cs = &client->stats.commands[cmd];
+        const char* name = hiomap_command_name(cmd);
+
+        if (name && cs->latency.count)
+        {
+            hiomap_cli_report(name, &cs->latency, cs->errors);
+        }
+    }
+
+    return read_errors || write_errors ? -EIO : 0;
+}
+
+/* Outcomes of a conformance check */
+enum hiomap_check_result
+{
+    HIOMAP_CHECK_PASS,
+    HIOMAP_CHECK_FAIL,
+    HIOMAP_CHECK_SKIP,
+};
+
+typedef enum hiomap_check_result (*hiomap_check)(
+    struct hiomap_client* client, const struct hiomap_cli_options* opts);
+
+static enum hiomap_check_result
+    hiomap_check_handshake(struct hiomap_client* client,
+                           const struct hiomap_cli_options* opts)
+{
+    if (hiomap_client_handshake(client) < 0 || client->version != 2)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    return HIOMAP_CHECK_PASS;
+}
+
+static enum hiomap_check_result
+    hiomap_check_flash_info(struct hiomap_client* client,
+                            const struct hiomap_cli_options* opts)
+{
+    uint32_t block = 1U << client->block_size_shift;
+
+    if (!client->flash_size || !client->erase_size ||
+        client->erase_size > client->flash_size ||
+        client->erase_size % block || client->flash_size % block)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    return HIOMAP_CHECK_PASS;
+}
+
+/* A versioned command repeating the last sequence number must be refused */
+static enum hiomap_check_result
+    hiomap_check_stale_sequence(struct hiomap_client* client,
+                                const struct hiomap_cli_options* opts)
+{
+    uint8_t req[] = {HIOMAP_C_GET_FLASH_INFO, client->seq};
+    uint8_t resp[8];
+    size_t len = sizeof(resp);
+
+    int rc = client->transport.transact(client, req, sizeof(req), resp, &len);
+
+    return rc == HIOMAP_CC_INVALID_FIELD_REQUEST ? HIOMAP_CHECK_PASS
+                                                 : HIOMAP_CHECK_FAIL;
+}
+
+static enum hiomap_check_result
+    hiomap_check_unknown_command(struct hiomap_client* client,
+                                 const struct hiomap_cli_options* opts)
+{
+    int rc = hiomap_client_command(client, 0x7f, NULL, 0, NULL, NULL);
+
+    return rc == HIOMAP_CC_PARM_OUT_OF_RANGE ? HIOMAP_CHECK_PASS
+                                             : HIOMAP_CHECK_FAIL;
+}
+
+static enum hiomap_check_result
+    hiomap_check_events(struct hiomap_client* client,
+                        const struct hiomap_cli_options* opts)
+{
+    uint8_t resp[5];
+    size_t len = sizeof(resp);
+
+    int rc = hiomap_client_command(client, HIOMAP_C_OEM_GET_EVENTS, NULL, 0,
+                                   resp, &len);
+    if (rc == HIOMAP_CC_PARM_OUT_OF_RANGE)
+    {
+        return HIOMAP_CHECK_SKIP;
+    }
+
+    if (rc || len < 5 || !(resp[0] & HIOMAP_CLIENT_EVENT_DAEMON_READY))
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    return HIOMAP_CHECK_PASS;
+}
+
+/* The window returned must contain the block asked for */
+static enum hiomap_check_result
+    hiomap_check_read_window(struct hiomap_client* client,
+                             const struct hiomap_cli_options* opts)
+{
+    uint16_t block = (client->flash_size >> client->block_size_shift) / 2;
+    uint8_t args[] = {uint8_t(block), uint8_t(block >> 8), 1, 0};
+    uint8_t resp[6];
+    size_t len = sizeof(resp);
+
+    client->window.open = false;
+
+    int rc = hiomap_client_command(client, HIOMAP_C_CREATE_READ_WINDOW, args,
+                                   sizeof(args), resp, &len);
+    if (rc || len < 6)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    uint16_t size = resp[2] | resp[3] << 8;
+    uint16_t offset = resp[4] | resp[5] << 8;
+
+    if (!size || offset > block || block - offset >= size)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    return HIOMAP_CHECK_PASS;
+}
+
+/* Inline reads must agree with reads through a window */
+static enum hiomap_check_result
+    hiomap_check_oem_read(struct hiomap_client* client,
+                          const struct hiomap_cli_options* opts)
+{
+    uint8_t args[] = {0, 0, 0, 0, 32};
+    uint8_t inline_data[32];
+    uint8_t window_data[32];
+    size_t len = sizeof(inline_data);
+
+    if (!client->lpc)
+    {
+        return HIOMAP_CHECK_SKIP;
+    }
+
+    int rc = hiomap_client_command(client, HIOMAP_C_OEM_READ, args,
+                                   sizeof(args), inline_data, &len);
+    if (rc == HIOMAP_CC_PARM_OUT_OF_RANGE || rc == HIOMAP_CC_NOT_PRESENT)
+    {
+        return HIOMAP_CHECK_SKIP;
+    }
+
+    if (rc || len != sizeof(inline_data) ||
+        hiomap_client_read(client, 0, window_data, sizeof(window_data)) < 0)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    return memcmp(inline_data, window_data, sizeof(window_data))
+               ? HIOMAP_CHECK_FAIL
+               : HIOMAP_CHECK_PASS;
+}
+
+/* Writes and erases must read back, and flush must reach the flash */
+static enum hiomap_check_result
+    hiomap_check_write_readback(struct hiomap_client* client,
+                                const struct hiomap_cli_options* opts)
+{
+    enum hiomap_check_result result = HIOMAP_CHECK_PASS;
+    uint32_t size = client->erase_size;
+    uint32_t offset = opts->scratch - opts->scratch % size;
+
+    if (!client->lpc || !opts->have_scratch || offset >= client->flash_size)
+    {
+        return HIOMAP_CHECK_SKIP;
+    }
+
+    std::vector<uint8_t> saved(size);
+    std::vector<uint8_t> pattern(size);
+    std::vector<uint8_t> actual(size);
+
+    if (hiomap_client_read(client, offset, saved.data(), size) < 0)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        pattern[i] = i ^ (i >> 8);
+    }
+
+    if (hiomap_client_write(client, offset, pattern.data(), size) < 0)
+    {
+        return HIOMAP_CHECK_FAIL;
+    }
+
+    /* Force the read back through a fresh window */
+    client->window.open = false;
+    if (hiomap_client_read(client, offset, actual.data(), size) < 0 ||
+        actual != pattern)
+    {
+        result = HIOMAP_CHECK_FAIL;
+    }
+
+    if (hiomap_client_erase(client, offset, size) < 0)
+    {
+        result = HIOMAP_CHECK_FAIL;
+    }
+
+    client->window.open = false;
+    if (hiomap_client_read(client, offset, actual.data(), size) < 0 ||
+        !std::all_of(actual.begin(), actual.end(),
+                     [](uint8_t b) { return b == 0xff; }))
+    {
+        result = HIOMAP_CHECK_FAIL;
+    }
+
+    if (hiomap_client_write(client, offset, saved.data(), size) < 0)
+    {
+        fprintf(stderr, "Failed to restore scratch block at 0x%x\n", offset);
+        result = HIOMAP_CHECK_FAIL;
+    }
+
+    return result;
+}
+
+static const struct
+{
+    const char* name;
+    hiomap_check check;
+} hiomap_checks[] = {
+    {"handshake", hiomap_check_handshake},
+    {"flash-info", hiomap_check_flash_info},
+    {"stale-sequence", hiomap_check_stale_sequence},
+    {"unknown-command", hiomap_check_unknown_command},
+    {"events", hiomap_check_events},
+    {"read-window", hiomap_check_read_window},
+    {"oem-read", hiomap_check_oem_read},
+    {"write-readback", hiomap_check_write_readback},
+};
+
+static int hiomap_cli_check(struct hiomap_client* client,
+                            const struct hiomap_cli_options* opts)
+{
+    static const char* const results[] = {"PASS", "FAIL", "SKIP"};
+    int failures = 0;
+
+    for (const auto& entry : hiomap_checks)
+    {
+        enum hiomap_check_result result = entry.check(client, opts);
+
+        printf("%-16s %s\n", entry.name, results[result]);
+        failures += result == HIOMAP_CHECK_FAIL;
+    }
+
+    return failures ? -EIO : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        {"socket", required_argument, NULL, 's'},
+        {"local", no_argument, NULL, 'L'},
+        {"lpc-file", required_argument, NULL, 'm'},
+        {"lpc-base", required_argument, NULL, 'b'},
+        {"lpc-size", required_argument, NULL, 'z'},
+        {"ops", required_argument, NULL, 'n'},
+        {"size", required_argument, NULL, 'S'},
+        {"start", required_argument, NULL, 'o'},
+        {"span", required_argument, NULL, 'r'},
+        {"writes", required_argument, NULL, 'w'},
+        {"sequential", no_argument, NULL, 'q'},
+        {"seed", required_argument, NULL, 'e'},
+        {"scratch", required_argument, NULL, 'x'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct hiomap_cli_options opts = {};
+    struct hiomap_client client = {};
+    int rc;
+    int c;
+
+    opts.socket = HIOMAP_SOCKET_PATH;
+    opts.ops = 1000;
+    opts.size = 4096;
+
+    while ((c = getopt_long(argc, argv, "s:Lm:b:z:n:S:o:r:w:qe:x:h",
+                            long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                opts.socket = optarg;
+                break;
+            case 'L':
+                opts.local = true;
+                break;
+            case 'm':
+                opts.lpc_path = optarg;
+                break;
+            case 'b':
+                opts.lpc_base = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                opts.lpc_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                opts.ops = strtoull(optarg, NULL, 0);
+                break;
+            case 'S':
+                opts.size = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                opts.start = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                opts.span = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                opts.writes = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                opts.sequential = true;
+                break;
+            case 'e':
+                opts.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                opts.have_scratch = true;
+                opts.scratch = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                hiomap_cli_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                hiomap_cli_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        hiomap_cli_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* cmd = argv[optind];
+    char** args = &argv[optind + 1];
+    int nargs = argc - optind - 1;
+
+    /* Works on files alone */
+    if (!strcmp(cmd, "diff") && nargs == 4)
+    {
+        rc = hiomap_cli_diff(strtoul(args[0], NULL, 0), args[1], args[2],
+                             args[3]);
+        return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    rc = opts.local ? hiomap_client_init_local(&client)
+                    : hiomap_client_init_socket(&client, opts.socket);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Failed to connect: %s\n", strerror(-rc));
+        return EXIT_FAILURE;
+    }
+
+    if (opts.lpc_path)
+    {
+        rc = hiomap_client_lpc_map(&client, opts.lpc_path, opts.lpc_base,
+                                   opts.lpc_size);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Failed to map %s: %s\n", opts.lpc_path,
+                    strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* The conformance checks do their own handshake */
+    if (strcmp(cmd, "check"))
+    {
+        rc = hiomap_client_handshake(&client);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Handshake failed: %s\n", strerror(-rc));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!strcmp(cmd, "info") && nargs == 0)
+    {
+        rc = hiomap_cli_info(&client);
+    }
+    else if (!strcmp(cmd, "read") && (nargs == 2 || nargs == 3))
+    {
+        rc = hiomap_cli_read(&client, strtoul(args[0], NULL, 0),
+                             strtoul(args[1], NULL, 0),
+                             nargs == 3 ? args[2] : NULL);
+    }
+    else if (!strcmp(cmd, "write") && nargs == 2)
+    {
+        rc = hiomap_cli_write(&client, strtoul(args[0], NULL, 0), args[1]);
+    }
+    else if (!strcmp(cmd, "erase") && nargs == 2)
+    {
+        rc = hiomap_client_erase(&client, strtoul(args[0], NULL, 0),
+                                 strtoul(args[1], NULL, 0));
+        if (rc < 0)
+        {
+            fprintf(stderr, "Erase failed: %s\n", strerror(-rc));
+        }
+    }
+    else if (!strcmp(cmd, "patch") && nargs == 1)
+    {
+        rc = hiomap_cli_patch(&client, args[0]);
+    }
+    else if (!strcmp(cmd, "load") && nargs == 0)
+    {
+        rc = hiomap_cli_load(&client, &opts);
+    }
+    else if (!strcmp(cmd, "check") && nargs == 0)
+    {
+        rc = hiomap_cli_check(&client, &opts);
+    }
+    else
+    {
+        hiomap_cli_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,769 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "client.hpp"
+
+#include "socket.hpp"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sdbusplus/bus.hpp>
+
+namespace openpower
+{
+namespace flash
+{
+
+static inline uint16_t hiomap_client_get16(const uint8_t* buf)
+{
+    uint16_t v;
+    std::memcpy(&v, buf, sizeof(v));
+    return le16toh(v);
+}
+
+static inline void hiomap_client_put16(uint8_t* buf, uint16_t v)
+{
+    v = htole16(v);
+    std::memcpy(buf, &v, sizeof(v));
+}
+
+static inline uint32_t hiomap_client_get32(const uint8_t* buf)
+{
+    uint32_t v;
+    std::memcpy(&v, buf, sizeof(v));
+    return le32toh(v);
+}
+
+static inline void hiomap_client_put32(uint8_t* buf, uint32_t v)
+{
+    v = htole32(v);
+    std::memcpy(buf, &v, sizeof(v));
+}
+
+static int hiomap_client_socket_transact(struct hiomap_client* client,
+                                         const uint8_t* req, size_t req_len,
+                                         uint8_t* resp, size_t* resp_len)
+{
+    int fd = reinterpret_cast<intptr_t>(client->transport.priv);
+    uint8_t msg[HIOMAP_SOCK_MSG_MAX];
+
+    if (req_len + 1 > sizeof(msg))
+    {
+        return -EMSGSIZE;
+    }
+
+    msg[0] = HIOMAP_SOCK_MSG_REQUEST;
+    std::memcpy(&msg[1], req, req_len);
+
+    if (send(fd, msg, req_len + 1, MSG_NOSIGNAL) < 0)
+    {
+        return -errno;
+    }
+
+    /* Event updates may arrive ahead of the response */
+    for (;;)
+    {
+        ssize_t len = recv(fd, msg, sizeof(msg), 0);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -errno;
+        }
+
+        if (len == 0)
+        {
+            return -ECONNRESET;
+        }
+
+        if (msg[0] == HIOMAP_SOCK_MSG_EVENT && len >= 2)
+        {
+            client->bmc_events = msg[1];
+            continue;
+        }
+
+        if (msg[0] != HIOMAP_SOCK_MSG_RESPONSE || len < 2)
+        {
+            return -EPROTO;
+        }
+
+        if (static_cast<size_t>(len - 2) > *resp_len)
+        {
+            return -EMSGSIZE;
+        }
+
+        std::memcpy(resp, &msg[2], len - 2);
+        *resp_len = len - 2;
+
+        return msg[1];
+    }
+}
+
+int hiomap_client_init_socket(struct hiomap_client* client, const char* path)
+{
+    struct sockaddr_un addr = {};
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -ENAMETOOLONG;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) <
+        0)
+    {
+        int rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    client->transport.transact = hiomap_client_socket_transact;
+    client->transport.priv = reinterpret_cast<void*>(intptr_t(fd));
+
+    return 0;
+}
+
+struct hiomap_client_local
+{
+    sdbusplus::bus::bus* bus;
+    sd_event* event;
+    struct hiomap* ctx;
+};
+
+static int hiomap_client_local_transact(struct hiomap_client* client,
+                                        const uint8_t* req, size_t req_len,
+                                        uint8_t* resp, size_t* resp_len)
+{
+    struct hiomap_client_local* local =
+        static_cast<struct hiomap_client_local*>(client->transport.priv);
+
+    int cc = hiomap_handle(local->ctx, req, req_len, resp, resp_len);
+
+    /* Deliver any hiomapd signals that arrived while we were busy */
+    while (sd_event_run(local->event, 0) > 0)
+    {
+    }
+
+    return cc;
+}
+
+int hiomap_client_init_local(struct hiomap_client* client)
+{
+    struct hiomap_client_local* local = new hiomap_client_local();
+    int rc;
+
+    rc = sd_event_default(&local->event);
+    if (rc < 0)
+    {
+        delete local;
+        return rc;
+    }
+
+    local->bus = new sdbusplus::bus::bus(sdbusplus::bus::new_default());
+    local->bus->attach_event(local->event, SD_EVENT_PRIORITY_NORMAL);
+    local->ctx = hiomap_new(local->bus, local->event,
+                            [client](struct hiomap*, uint8_t events) {
+                                client->bmc_events = events;
+                            });
+
+    client->transport.transact = hiomap_client_local_transact;
+    client->transport.priv = local;
+
+    return 0;
+}
+
+int hiomap_client_lpc_map(struct hiomap_client* client, const char* path,
+                          uint32_t base, size_t size)
+{
+    struct stat st;
+    int rc = 0;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (!size)
+    {
+        if (fstat(fd, &st) < 0)
+        {
+            rc = -errno;
+            close(fd);
+            return rc;
+        }
+
+        size = st.st_size;
+    }
+
+    void* lpc = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (lpc == MAP_FAILED)
+    {
+        rc = -errno;
+    }
+    else
+    {
+        client->lpc = static_cast<uint8_t*>(lpc);
+        client->lpc_base = base;
+        client->lpc_size = size;
+    }
+
+    /* The mapping holds its own reference to the file */
+    close(fd);
+
+    return rc;
+}
+
+int hiomap_client_errno(int rc)
+{
+    switch (rc)
+    {
+        case HIOMAP_CC_OK:
+            return 0;
+        case HIOMAP_CC_BUSY:
+            return -EBUSY;
+        case HIOMAP_CC_INVALID:
+            return -ENOTSUP;
+        case HIOMAP_CC_TIMEOUT:
+            return -ETIMEDOUT;
+        case HIOMAP_CC_NO_SPACE:
+            return -ENOSPC;
+        case HIOMAP_CC_REQ_DATA_LEN_INVALID:
+        case HIOMAP_CC_PARM_OUT_OF_RANGE:
+            return -EINVAL;
+        case HIOMAP_CC_NOT_PRESENT:
+            return -ENODEV;
+        case HIOMAP_CC_INVALID_FIELD_REQUEST:
+            return -EPROTO;
+        case HIOMAP_CC_INSUFFICIENT_PRIVILEGE:
+            return -EPERM;
+        default:
+            return rc < 0 ? rc : -EIO;
+    }
+}
+
+int hiomap_client_command(struct hiomap_client* client, uint8_t cmd,
+                          const uint8_t* args, size_t args_len, uint8_t* resp,
+                          size_t* resp_len)
+{
+    uint8_t req[HIOMAP_SOCK_MSG_MAX];
+    uint8_t buf[HIOMAP_SOCK_MSG_MAX];
+    size_t len = sizeof(buf);
+
+    if (args_len + 2 > sizeof(req))
+    {
+        return -EMSGSIZE;
+    }
+
+    req[0] = cmd;
+    req[1] = ++client->seq;
+    if (args_len)
+    {
+        std::memcpy(&req[2], args, args_len);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int rc = client->transport.transact(client, req, args_len + 2, buf, &len);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    hiomap_stats_record(
+        &client->stats, cmd, rc,
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+    if (rc != HIOMAP_CC_OK)
+    {
+        return rc;
+    }
+
+    /* The BMC must echo the command and sequence number it handled */
+    if (len < 2 || buf[0] != cmd || buf[1] != client->seq)
+    {
+        return -EPROTO;
+    }
+
+    if (resp_len)
+    {
+        *resp_len = std::min(*resp_len, len - 2);
+        std::memcpy(resp, &buf[2], *resp_len);
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+int hiomap_client_handshake(struct hiomap_client* client)
+{
+    uint8_t version = 2;
+    uint8_t resp[6];
+    size_t len;
+    int rc;
+
+    client->window.open = false;
+
+    rc = hiomap_client_command(client, HIOMAP_C_RESET, NULL, 0, NULL, NULL);
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    len = sizeof(resp);
+    rc = hiomap_client_command(client, HIOMAP_C_GET_INFO, &version, 1, resp,
+                               &len);
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    if (len < 4 || resp[0] != 2)
+    {
+        return -ENOTSUP;
+    }
+
+    client->version = resp[0];
+    client->block_size_shift = resp[1];
+    client->timeout = hiomap_client_get16(&resp[2]);
+
+    len = sizeof(resp);
+    rc = hiomap_client_command(client, HIOMAP_C_GET_FLASH_INFO, NULL, 0, resp,
+                               &len);
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    if (len < 4)
+    {
+        return -EPROTO;
+    }
+
+    client->flash_size = hiomap_client_get16(&resp[0])
+                         << client->block_size_shift;
+    client->erase_size = hiomap_client_get16(&resp[2])
+                         << client->block_size_shift;
+
+    /* Seed the event state; without the OEM command, assume the BMC is up */
+    len = sizeof(resp);
+    rc = hiomap_client_command(client, HIOMAP_C_OEM_GET_EVENTS, NULL, 0, resp,
+                               &len);
+    if (rc == HIOMAP_CC_OK && len >= 1)
+    {
+        client->bmc_events = resp[0];
+    }
+    else
+    {
+        client->bmc_events = HIOMAP_CLIENT_EVENT_DAEMON_READY;
+    }
+
+    return 0;
+}
+
+int hiomap_client_handle_events(struct hiomap_client* client)
+{
+    uint8_t ack = client->bmc_events & HIOMAP_CLIENT_EVENT_ACK_MASK;
+    int rc;
+
+    if (ack)
+    {
+        rc = hiomap_client_command(client, HIOMAP_C_ACK, &ack, 1, NULL, NULL);
+        if (rc)
+        {
+            return hiomap_client_errno(rc);
+        }
+
+        client->bmc_events &= ~ack;
+
+        /* Either way the BMC has dropped our window */
+        client->window.open = false;
+
+        if (ack & HIOMAP_CLIENT_EVENT_PROTOCOL_RESET)
+        {
+            rc = hiomap_client_handshake(client);
+            if (rc < 0)
+            {
+                return rc;
+            }
+        }
+    }
+
+    if ((client->bmc_events & HIOMAP_CLIENT_EVENT_FLASH_CTRL_LOST) ||
+        !(client->bmc_events & HIOMAP_CLIENT_EVENT_DAEMON_READY))
+    {
+        return -EBUSY;
+    }
+
+    return 0;
+}
+
+/*
+ * Make sure the window covers pos, opening a new one if not, and return where
+ * pos appears in the LPC FW space. *chunk is set to how much of len the window
+ * covers.
+ */
+static int hiomap_client_window(struct hiomap_client* client, bool ro,
+                                uint32_t pos, size_t len, uint8_t** lpc,
+                                size_t* chunk)
+{
+    uint8_t shift = client->block_size_shift;
+    auto& window = client->window;
+    int rc;
+
+    if (!client->lpc)
+    {
+        return -ENODEV;
+    }
+
+    /* A write window can serve reads, but not the other way around */
+    bool usable = window.open && (ro || !window.ro) && pos >= window.offset &&
+                  pos - window.offset < window.size;
+
+    if (!usable)
+    {
+        uint32_t block = pos >> shift;
+        uint64_t end = uint64_t(pos) + len;
+        uint32_t blocks = ((end + (1 << shift) - 1) >> shift) - block;
+        uint8_t args[4];
+        uint8_t resp[6];
+        size_t resp_len = sizeof(resp);
+
+        hiomap_client_put16(&args[0], block);
+        hiomap_client_put16(&args[2], std::min<uint32_t>(blocks, UINT16_MAX));
+
+        window.open = false;
+
+        rc = hiomap_client_command(client,
+                                   ro ? HIOMAP_C_CREATE_READ_WINDOW
+                                      : HIOMAP_C_CREATE_WRITE_WINDOW,
+                                   args, sizeof(args), resp, &resp_len);
+        if (rc)
+        {
+            return hiomap_client_errno(rc);
+        }
+
+        if (resp_len < 6)
+        {
+            return -EPROTO;
+        }
+
+        window.lpc_addr = uint32_t(hiomap_client_get16(&resp[0])) << shift;
+        window.size = uint32_t(hiomap_client_get16(&resp[2])) << shift;
+        window.offset = uint32_t(hiomap_client_get16(&resp[4])) << shift;
+        window.ro = ro;
+
+        /* The BMC may grow the window but it must contain what we asked for */
+        if (pos < window.offset || pos - window.offset >= window.size)
+        {
+            return -EPROTO;
+        }
+
+        if (window.lpc_addr < client->lpc_base ||
+            window.lpc_addr - client->lpc_base + uint64_t(window.size) >
+                client->lpc_size)
+        {
+            return -ERANGE;
+        }
+
+        window.open = true;
+    }
+
+    *chunk = std::min<size_t>(len, window.offset + window.size - pos);
+    *lpc = client->lpc + (window.lpc_addr - client->lpc_base) +
+           (pos - window.offset);
+
+    return 0;
+}
+
+int hiomap_client_read(struct hiomap_client* client, uint32_t offset,
+                       void* buf, size_t len)
+{
+    uint8_t* cursor = static_cast<uint8_t*>(buf);
+    int rc;
+
+    while (len)
+    {
+        uint8_t* lpc;
+        size_t chunk;
+
+        rc = hiomap_client_handle_events(client);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        rc = hiomap_client_window(client, true, offset, len, &lpc, &chunk);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        std::memcpy(cursor, lpc, chunk);
+
+        cursor += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+/* MarkDirty or Erase [pos, pos + len) of the write window, then flush it */
+static int hiomap_client_commit(struct hiomap_client* client, uint8_t cmd,
+                                uint32_t pos, size_t len)
+{
+    uint8_t shift = client->block_size_shift;
+    uint32_t start = (pos - client->window.offset) >> shift;
+    uint64_t end = uint64_t(pos - client->window.offset) + len;
+    uint8_t args[4];
+    int rc;
+
+    hiomap_client_put16(&args[0], start);
+    hiomap_client_put16(&args[2],
+                        ((end + (1 << shift) - 1) >> shift) - start);
+
+    rc = hiomap_client_command(client, cmd, args, sizeof(args), NULL, NULL);
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    rc = hiomap_client_command(client, HIOMAP_C_FLUSH, NULL, 0, NULL, NULL);
+
+    return hiomap_client_errno(rc);
+}
+
+int hiomap_client_write(struct hiomap_client* client, uint32_t offset,
+                        const void* buf, size_t len)
+{
+    const uint8_t* cursor = static_cast<const uint8_t*>(buf);
+    int rc;
+
+    while (len)
+    {
+        uint8_t* lpc;
+        size_t chunk;
+
+        rc = hiomap_client_handle_events(client);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        rc = hiomap_client_window(client, false, offset, len, &lpc, &chunk);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        std::memcpy(lpc, cursor, chunk);
+
+        rc = hiomap_client_commit(client, HIOMAP_C_MARK_DIRTY, offset, chunk);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        cursor += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+int hiomap_client_erase(struct hiomap_client* client, uint32_t offset,
+                        size_t len)
+{
+    uint32_t mask = (1 << client->block_size_shift) - 1;
+    int rc;
+
+    /* Erase is block granular in the protocol */
+    if ((offset & mask) || (len & mask))
+    {
+        return -EINVAL;
+    }
+
+    while (len)
+    {
+        uint8_t* lpc;
+        size_t chunk;
+
+        rc = hiomap_client_handle_events(client);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        rc = hiomap_client_window(client, false, offset, len, &lpc, &chunk);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        rc = hiomap_client_commit(client, HIOMAP_C_ERASE, offset, chunk);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        offset += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+/* Delta bytes per command, well within a socket packet */
+#define HIOMAP_CLIENT_DELTA_CHUNK 2048
+#define HIOMAP_CLIENT_DELTA_POLL_US 100000
+
+/* Poll until the BMC reports it has finished applying a delta */
+static int hiomap_client_patch_wait(struct hiomap_client* client)
+{
+    uint8_t resp[1];
+    size_t resp_len;
+    int rc;
+
+    while (!(client->bmc_events & HIOMAP_EVENT_OEM_DELTA_APPLIED))
+    {
+        usleep(HIOMAP_CLIENT_DELTA_POLL_US);
+
+        resp_len = sizeof(resp);
+        rc = hiomap_client_command(client, HIOMAP_C_OEM_GET_EVENTS, NULL, 0,
+                                   resp, &resp_len);
+        if (rc)
+        {
+            return hiomap_client_errno(rc);
+        }
+
+        if (resp_len < 1)
+        {
+            return -EPROTO;
+        }
+
+        client->bmc_events = resp[0];
+    }
+
+    return 0;
+}
+
+int hiomap_client_patch(struct hiomap_client* client, const void* delta,
+                        size_t len, uint16_t* rewritten, uint16_t* unchanged)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(delta);
+    uint8_t args[4 + HIOMAP_CLIENT_DELTA_CHUNK];
+    uint8_t resp[5];
+    size_t resp_len;
+    uint32_t pos = 0;
+    int rc;
+
+    if (len > HIOMAP_DELTA_MAX)
+    {
+        return -EFBIG;
+    }
+
+    hiomap_client_put32(&args[0], len);
+    rc = hiomap_client_command(client, HIOMAP_C_OEM_DELTA_START, args, 4, NULL,
+                               NULL);
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    /* Starting a delta drops any earlier outcome */
+    client->bmc_events &= ~HIOMAP_EVENT_OEM_DELTA_APPLIED;
+
+    while (pos < len)
+    {
+        size_t chunk = std::min<size_t>(len - pos, HIOMAP_CLIENT_DELTA_CHUNK);
+
+        hiomap_client_put32(&args[0], pos);
+        std::memcpy(&args[4], data + pos, chunk);
+
+        resp_len = sizeof(resp);
+        rc = hiomap_client_command(client, HIOMAP_C_OEM_DELTA_DATA, args,
+                                   4 + chunk, resp, &resp_len);
+        if (rc)
+        {
+            return hiomap_client_errno(rc);
+        }
+
+        /* Carry on from wherever the BMC got to */
+        if (resp_len < 4 || hiomap_client_get32(resp) <= pos)
+        {
+            return -EPROTO;
+        }
+
+        pos = hiomap_client_get32(resp);
+    }
+
+    resp_len = sizeof(resp);
+    rc = hiomap_client_command(client, HIOMAP_C_OEM_DELTA_APPLY, NULL, 0, resp,
+                               &resp_len);
+
+    /* The BMC applies it in the background and raises an event when done */
+    if (rc == HIOMAP_CC_OK && resp_len >= 1 &&
+        resp[0] == HIOMAP_DELTA_STATUS_RUNNING)
+    {
+        uint8_t ack = HIOMAP_EVENT_OEM_DELTA_APPLIED;
+
+        rc = hiomap_client_patch_wait(client);
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        resp_len = sizeof(resp);
+        rc = hiomap_client_command(client, HIOMAP_C_OEM_DELTA_APPLY, NULL, 0,
+                                   resp, &resp_len);
+
+        /* The outcome is collected, whatever it was */
+        int ack_rc = hiomap_client_command(client, HIOMAP_C_ACK, &ack, 1,
+                                           NULL, NULL);
+        if (!rc && ack_rc)
+        {
+            return hiomap_client_errno(ack_rc);
+        }
+
+        client->bmc_events &= ~ack;
+    }
+
+    if (rc)
+    {
+        return hiomap_client_errno(rc);
+    }
+
+    if (resp_len < 5 || resp[0] != HIOMAP_DELTA_STATUS_DONE)
+    {
+        return -EPROTO;
+    }
+
+    *rewritten = hiomap_client_get16(&resp[1]);
+    *unchanged = hiomap_client_get16(&resp[3]);
+
+    return 0;
+}
+
+} // namespace flash
+} // namespace openpower
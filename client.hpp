@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_CLIENT_H
+#define HIOMAP_CLIENT_H
+
+#include "hiomap.hpp"
+#include "stats.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * A host-side HIOMAP client modelled on skiboot's ipmi-hiomap: it tracks the
+ * sequence number, acknowledges BMC events, moves the window as accesses
+ * require and reaches flash contents through an emulated LPC FW space.
+ */
+#define HIOMAP_CLIENT_EVENT_DAEMON_READY (1 << 7)
+#define HIOMAP_CLIENT_EVENT_FLASH_CTRL_LOST (1 << 6)
+#define HIOMAP_CLIENT_EVENT_WINDOW_RESET (1 << 1)
+#define HIOMAP_CLIENT_EVENT_PROTOCOL_RESET (1 << 0)
+
+/* Events the host must acknowledge */
+#define HIOMAP_CLIENT_EVENT_ACK_MASK                                           \
+    (HIOMAP_CLIENT_EVENT_WINDOW_RESET | HIOMAP_CLIENT_EVENT_PROTOCOL_RESET)
+
+struct hiomap_client;
+
+struct hiomap_client_transport
+{
+    /*
+     * Exchange a request of the form [command, sequence, arguments...] for
+     * its response. On entry *resp_len is the space available in resp.
+     *
+     * Returns a HIOMAP_CC_* completion code, or a negative errno if the
+     * transport failed.
+     */
+    int (*transact)(struct hiomap_client* client, const uint8_t* req,
+                    size_t req_len, uint8_t* resp, size_t* resp_len);
+    void* priv;
+};
+
+struct hiomap_client
+{
+    struct hiomap_client_transport transport;
+    uint8_t seq;
+
+    /* Latest event flags, updated by the transport */
+    uint8_t bmc_events;
+
+    /* Protocol parameters from GetInfo and GetFlashInfo */
+    uint8_t version;
+    uint8_t block_size_shift;
+    uint16_t timeout;
+    uint32_t flash_size;
+    uint32_t erase_size;
+
+    /* The active window, in bytes */
+    struct
+    {
+        bool open;
+        bool ro;
+        uint32_t lpc_addr;
+        uint32_t offset;
+        uint32_t size;
+    } window;
+
+    /* The emulated LPC FW space that windows are mapped into */
+    uint8_t* lpc;
+    uint32_t lpc_base;
+    size_t lpc_size;
+
+    /* Indexed by HIOMAP command ID, as seen from the host */
+    struct hiomap_stats stats;
+};
+
+/*
+ * Connect to hiomap-socketd at path.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_client_init_socket(struct hiomap_client* client, const char* path);
+
+/*
+ * Run the protocol core in this process, talking to hiomapd directly. Don't
+ * use this while the ipmid provider or hiomap-socketd is active.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_client_init_local(struct hiomap_client* client);
+
+/*
+ * Map size bytes of path as the LPC FW space starting at LPC address base.
+ * A size of 0 maps the whole file.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_client_lpc_map(struct hiomap_client* client, const char* path,
+                          uint32_t base, size_t size);
+
+/*
+ * Issue a single command, recording its latency. Returns a HIOMAP_CC_*
+ * completion code or a negative errno.
+ */
+int hiomap_client_command(struct hiomap_client* client, uint8_t cmd,
+                          const uint8_t* args, size_t args_len, uint8_t* resp,
+                          size_t* resp_len);
+
+/* Reset the protocol and negotiate version 2. Returns 0 or a negative errno. */
+int hiomap_client_handshake(struct hiomap_client* client);
+
+/*
+ * Acknowledge outstanding events and recover from resets, as a host does
+ * before each access. Returns -EBUSY while the BMC has lost control of the
+ * flash or its daemon is not ready.
+ */
+int hiomap_client_handle_events(struct hiomap_client* client);
+
+/* Byte-granular flash access through windows. Return 0 or a negative errno. */
+int hiomap_client_read(struct hiomap_client* client, uint32_t offset,
+                       void* buf, size_t len);
+int hiomap_client_write(struct hiomap_client* client, uint32_t offset,
+                        const void* buf, size_t len);
+int hiomap_client_erase(struct hiomap_client* client, uint32_t offset,
+                        size_t len);
+
+/*
+ * Send a delta in the HIOMAP_DELTA_* record format and have the BMC apply it
+ * to flash, polling until it has. On success, reports how many erase blocks
+ * were rewritten and how many the delta left as they were. The IPMI provider
+ * refuses deltas, so this needs the socket transport.
+ *
+ * Returns 0 or a negative errno.
+ */
+int hiomap_client_patch(struct hiomap_client* client, const void* delta,
+                        size_t len, uint16_t* rewritten, uint16_t* unchanged);
+
+/* Map a completion code or negative errno from the above to an errno */
+int hiomap_client_errno(int rc);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_CLIENT_H */
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "coalesce.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* The idle flush waits for a gap this many times the usual one */
+constexpr uint32_t HIOMAP_IDLE_GAP_MULTIPLE = 4;
+
+void hiomap_gaps_record(struct hiomap_gaps* gaps, uint64_t now_us)
+{
+    /* The first arrival only starts the clock */
+    if (gaps->last_us)
+    {
+        uint64_t gap = now_us - gaps->last_us;
+
+        gaps->us[gaps->next] = std::min<uint64_t>(
+            gap, std::numeric_limits<uint32_t>::max());
+        gaps->next = (gaps->next + 1) % gaps->us.size();
+        gaps->count = std::min(gaps->count + 1, gaps->us.size());
+    }
+
+    gaps->last_us = now_us;
+}
+
+uint32_t hiomap_gaps_quantile(const struct hiomap_gaps* gaps, double q)
+{
+    if (gaps->count < HIOMAP_GAPS_MIN_SAMPLES)
+    {
+        return 0;
+    }
+
+    std::array<uint32_t, HIOMAP_GAPS_WINDOW> sorted = gaps->us;
+    size_t rank = std::min<size_t>(q * gaps->count, gaps->count - 1);
+
+    std::nth_element(sorted.begin(), sorted.begin() + rank,
+                     sorted.begin() + gaps->count);
+
+    return sorted[rank];
+}
+
+uint64_t hiomap_gaps_idle_delay(const struct hiomap_gaps* gaps,
+                                uint64_t delay_us, uint64_t floor_us)
+{
+    uint32_t gap = hiomap_gaps_quantile(gaps, 0.9);
+
+    if (!gap)
+    {
+        return delay_us;
+    }
+
+    return std::min<uint64_t>(
+        delay_us,
+        std::max<uint64_t>(uint64_t(gap) * HIOMAP_IDLE_GAP_MULTIPLE, floor_us));
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_COALESCE_H
+#define HIOMAP_COALESCE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Recent gaps kept for estimating the inter-arrival distribution */
+constexpr size_t HIOMAP_GAPS_WINDOW = 64;
+
+/* Gaps required before the estimate is used */
+constexpr size_t HIOMAP_GAPS_MIN_SAMPLES = 8;
+
+/*
+ * Inter-arrival times of a stream of events, such as host commands. Only the
+ * most recent gaps are kept so the estimate follows changes in the host's
+ * behaviour.
+ */
+struct hiomap_gaps
+{
+    std::array<uint32_t, HIOMAP_GAPS_WINDOW> us;
+    size_t count;
+    size_t next;
+    uint64_t last_us;
+};
+
+/* Note an arrival at now_us on CLOCK_MONOTONIC */
+void hiomap_gaps_record(struct hiomap_gaps* gaps, uint64_t now_us);
+
+/*
+ * The q-quantile (0 <= q <= 1) of the recent gaps in microseconds, or 0 if
+ * too few have been seen.
+ */
+uint32_t hiomap_gaps_quantile(const struct hiomap_gaps* gaps, double q);
+
+/*
+ * Modifying calls since the last flush after which the host is taken to be
+ * streaming changes into its window rather than making a one-off update, and
+ * is given the full idle delay
+ */
+constexpr size_t HIOMAP_IDLE_STREAM_CALLS = 2;
+
+/*
+ * How long to wait, at most delay_us and at least floor_us, before taking a
+ * quiet stream to have finished for now. A host streaming writes pauses only
+ * briefly between commands, so a gap well beyond its usual one is enough.
+ */
+uint64_t hiomap_gaps_idle_delay(const struct hiomap_gaps* gaps,
+                                uint64_t delay_us, uint64_t floor_us);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_COALESCE_H */
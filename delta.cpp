@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "delta.hpp"
+
+#include "hiomap.hpp"
+
+#include <endian.h>
+
+#include <cstring>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* [op][offset (le32)][length (le32)] */
+constexpr size_t HIOMAP_DELTA_HEADER = 9;
+
+static uint32_t hiomap_delta_le32(const uint8_t* buf)
+{
+    uint32_t v;
+
+    std::memcpy(&v, buf, sizeof(v));
+
+    return le32toh(v);
+}
+
+int hiomap_delta_parse(const std::vector<uint8_t>& delta, uint32_t flash_size,
+                       std::vector<struct hiomap_backend_op>& ops)
+{
+    size_t pos = 0;
+
+    while (pos < delta.size())
+    {
+        if (delta.size() - pos < HIOMAP_DELTA_HEADER)
+        {
+            return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+        }
+
+        uint8_t op = delta[pos];
+        uint32_t offset = hiomap_delta_le32(&delta[pos + 1]);
+        uint32_t len = hiomap_delta_le32(&delta[pos + 5]);
+        struct hiomap_backend_op record = {offset, len, NULL};
+
+        pos += HIOMAP_DELTA_HEADER;
+
+        if (len > HIOMAP_DELTA_RECORD_MAX || offset > flash_size ||
+            len > flash_size - offset)
+        {
+            return HIOMAP_CC_PARM_OUT_OF_RANGE;
+        }
+
+        switch (op)
+        {
+            case HIOMAP_DELTA_DATA:
+                if (delta.size() - pos < len)
+                {
+                    return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+                }
+
+                record.data = &delta[pos];
+                pos += len;
+                break;
+            case HIOMAP_DELTA_FILL:
+                if (delta.size() - pos < 1)
+                {
+                    return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+                }
+
+                record.fill = delta[pos];
+                pos += 1;
+                break;
+            default:
+                return HIOMAP_CC_INVALID_FIELD_REQUEST;
+        }
+
+        if (len)
+        {
+            ops.push_back(record);
+        }
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+} // namespace flash
+} // namespace openpower
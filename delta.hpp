@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_DELTA_H
+#define HIOMAP_DELTA_H
+
+#include "backend.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * Check a delta in the HIOMAP_DELTA_* record format against flash of
+ * flash_size bytes, appending a backend operation for each record that
+ * covers any flash. Data operations point into delta, and fills carry their
+ * byte, so nothing the size of the flash is allocated.
+ *
+ * Returns a HIOMAP_CC_* completion code: HIOMAP_CC_REQ_DATA_LEN_INVALID for
+ * a truncated record, HIOMAP_CC_PARM_OUT_OF_RANGE for a record longer than
+ * HIOMAP_DELTA_RECORD_MAX or reaching past the end of flash, and
+ * HIOMAP_CC_INVALID_FIELD_REQUEST for an unknown operation.
+ */
+int hiomap_delta_parse(const std::vector<uint8_t>& delta, uint32_t flash_size,
+                       std::vector<struct hiomap_backend_op>& ops);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_DELTA_H */
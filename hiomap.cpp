@@ -5,28 +5,36 @@
 
 #include "hiomap.hpp"
 
+#include "backend.hpp"
+#include "budget.hpp"
+#include "coalesce.hpp"
+#include "delta.hpp"
+#include "policy.hpp"
+#include "settings.hpp"
+#include "shadow.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
 #include <endian.h>
-#include <host-ipmid/ipmid-api.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <functional>
-#include <host-ipmid/ipmid-host-cmd-utils.hpp>
-#include <host-ipmid/ipmid-host-cmd.hpp>
 #include <iostream>
 #include <map>
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/bus.hpp>
 #include <sdbusplus/bus/match.hpp>
 #include <sdbusplus/exception.hpp>
+#include <set>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 using namespace sdbusplus;
-using namespace phosphor::host::command;
-
-static void register_openpower_hiomap_commands() __attribute__((constructor));
 
 namespace openpower
 {
@@ -37,33 +45,169 @@ constexpr auto BMC_EVENT_FLASH_CTRL_LOST = 1 << 6;
 constexpr auto BMC_EVENT_WINDOW_RESET = 1 << 1;
 constexpr auto BMC_EVENT_PROTOCOL_RESET = 1 << 0;
 
-constexpr auto IPMI_CMD_HIOMAP_EVENT = 0x0f;
-
 constexpr auto HIOMAPD_SERVICE = "xyz.openbmc_project.Hiomapd";
 constexpr auto HIOMAPD_OBJECT = "/xyz/openbmc_project/Hiomapd";
 constexpr auto HIOMAPD_IFACE = "xyz.openbmc_project.Hiomapd.Protocol";
 constexpr auto HIOMAPD_IFACE_V2 = "xyz.openbmc_project.Hiomapd.Protocol.V2";
+constexpr auto HIOMAPD_IFACE_CONTROL = "xyz.openbmc_project.Hiomapd.Control";
 
 constexpr auto DBUS_IFACE_PROPERTIES = "org.freedesktop.DBus.Properties";
 
+constexpr auto HOST_STATE_SERVICE = "xyz.openbmc_project.State.Host";
+constexpr auto HOST_STATE_OBJECT = "/xyz/openbmc_project/state/host0";
+constexpr auto HOST_STATE_IFACE = "xyz.openbmc_project.State.Host";
+constexpr auto HOST_STATE_OFF = "xyz.openbmc_project.State.Host.HostState.Off";
+constexpr auto HOST_TRANSITION_ON =
+    "xyz.openbmc_project.State.Host.Transition.On";
+constexpr auto HOST_TRANSITION_REBOOT =
+    "xyz.openbmc_project.State.Host.Transition.Reboot";
+
 struct hiomap
 {
     bus::bus* bus;
+    sd_event* event;
+
+    /* Delivers BMC event updates to the host over the transport */
+    hiomap_notify notify;
 
     /* Signals */
     bus::match::match* properties;
     bus::match::match* window_reset;
     bus::match::match* bmc_reboot;
+    bus::match::match* host_state;
 
     /* Protocol state */
     std::map<std::string, int> event_lookup;
     uint8_t bmc_events;
+    uint32_t event_generation;
     uint8_t seq;
+
+    /* Merges event updates that arrive close together */
+    sd_event_source* event_timer;
+
+    /* Inter-arrival times of host commands, for sizing the idle delay */
+    struct hiomap_gaps command_gaps;
+
+    /* Flash geometry, as reported by hiomapd. Sizes are in blocks. */
+    uint8_t block_size_shift;
+    uint16_t flash_size;
+    uint16_t erase_size;
+
+    /* The active window, as reported by hiomapd. Sizes are in blocks. */
+    struct
+    {
+        bool open;
+        bool ro;
+        uint16_t offset;
+        uint16_t size;
+    } window;
+
+    /* Sequential read stream detection */
+    struct hiomap_readahead readahead;
+
+    /* Host power state, so caches are only held while they can be used */
+    bool host_off;
+
+    /*
+     * Erase blocks the host has opened windows on since powering on, in the
+     * order it first did so. These are warmed first on the next power on.
+     */
+    std::vector<bool> boot_seen;
+    std::vector<size_t> boot_blocks;
+
+    /* Flash ranges modified by the host since the last flush, in bytes */
+    std::vector<std::pair<uint32_t, uint32_t>> dirty;
+
+    /*
+     * Times we suspended hiomapd to write the flash directly whose
+     * FlashControlLost transitions we have yet to see. The caches stay valid
+     * across these, as our own writes invalidate what they change.
+     */
+    uint32_t own_suspends;
+
+    /* Direct flash access and its RAM shadow */
+    struct hiomap_backend backend;
+    struct hiomap_shadow shadow;
+    struct hiomap_store store;
+
+    /* Memory shared by the caches above */
+    struct hiomap_budget budget;
+
+    /* Tunables */
+    struct hiomap_settings_store settings;
+
+    /* Statistics */
+    struct hiomap_stats stats;
+    sd_event_source* stats_timer;
+    int stats_export_err;
+
+    /*
+     * Latency of the Flush and Erase calls hiomapd completed, aged so the
+     * suggested timeout follows changes in the flash
+     */
+    struct hiomap_histogram writeback_latency;
+
+    /* Requests recorded for replay through hiomap-sim */
+    struct hiomap_trace trace;
+
+    /* Fires once the host has left dirty data and gone quiet */
+    sd_event_source* idle_timer;
+
+    /* MarkDirty calls acknowledged to the host but not yet sent */
+    struct
+    {
+        /*
+         * A private connection: we may be running inside a callback on the
+         * shared one, where it can't be processed to collect replies.
+         */
+        sd_bus* bus;
+        std::vector<std::tuple<const char*, uint16_t, uint16_t>> queue;
+        /* Completion code of the first failure not yet reported */
+        int error;
+    } pipeline;
+
+    /*
+     * Window ranges the host has marked dirty but hiomapd has yet to hear
+     * about, so that an idle write-back can be fed to it an erase block at a
+     * time. Sizes are in blocks.
+     */
+    struct
+    {
+        std::vector<std::pair<uint16_t, uint16_t>> held;
+        /* Writes back the next erase block when enabled */
+        sd_event_source* step;
+    } writeback;
+
+    /* A delta being received from the host, and then applied */
+    struct
+    {
+        bool active;
+        uint32_t size;
+        std::vector<uint8_t> data;
+
+        /* Set while applying, then done until the outcome is collected */
+        bool applying;
+        bool done;
+        int cc;
+        /* The records, pointing into data, and their indices by offset */
+        std::vector<struct hiomap_backend_op> ops;
+        std::vector<uint32_t> order;
+        /* Erase blocks the records touch, by offset, and the next to apply */
+        std::vector<uint32_t> blocks;
+        size_t next;
+        uint64_t rewritten;
+        uint64_t unchanged;
+
+        /* Charged for the received data and the apply's working set */
+        struct hiomap_budget_client budget;
+        /* Applies the next erase block when enabled */
+        sd_event_source* step;
+    } delta;
 };
 
 /* TODO: Replace get/put with packed structs and direct assignment */
 template <typename T>
-static inline T get(void* buf)
+static inline T get(const void* buf)
 {
     T t;
     std::memcpy(&t, buf, sizeof(t));
@@ -76,9 +220,9 @@ static inline void put(void* buf, T&& t)
     std::memcpy(buf, &t, sizeof(t));
 }
 
-typedef ipmi_ret_t (*hiomap_command)(ipmi_request_t req, ipmi_response_t resp,
-                                     ipmi_data_len_t data_len,
-                                     ipmi_context_t context);
+/* On entry *resp_len is the space available in resp */
+typedef int (*hiomap_command)(struct hiomap* ctx, const uint8_t* req,
+                              size_t req_len, uint8_t* resp, size_t* resp_len);
 
 struct errno_cc_entry
 {
@@ -87,16 +231,16 @@ struct errno_cc_entry
 };
 
 static const errno_cc_entry errno_cc_map[] = {
-    {0, IPMI_CC_OK},
-    {EBUSY, IPMI_CC_BUSY},
-    {ENOTSUP, IPMI_CC_INVALID},
-    {ETIMEDOUT, 0xc3}, /* FIXME: Replace when defined in ipmid-api.h */
-    {ENOSPC, 0xc4},    /* FIXME: Replace when defined in ipmid-api.h */
-    {EINVAL, IPMI_CC_PARM_OUT_OF_RANGE},
-    {ENODEV, IPMI_CC_SENSOR_INVALID},
-    {EPERM, IPMI_CC_INSUFFICIENT_PRIVILEGE},
-    {EACCES, IPMI_CC_INSUFFICIENT_PRIVILEGE},
-    {-1, IPMI_CC_UNSPECIFIED_ERROR},
+    {0, HIOMAP_CC_OK},
+    {EBUSY, HIOMAP_CC_BUSY},
+    {ENOTSUP, HIOMAP_CC_INVALID},
+    {ETIMEDOUT, HIOMAP_CC_TIMEOUT},
+    {ENOSPC, HIOMAP_CC_NO_SPACE},
+    {EINVAL, HIOMAP_CC_PARM_OUT_OF_RANGE},
+    {ENODEV, HIOMAP_CC_NOT_PRESENT},
+    {EPERM, HIOMAP_CC_INSUFFICIENT_PRIVILEGE},
+    {EACCES, HIOMAP_CC_INSUFFICIENT_PRIVILEGE},
+    {-1, HIOMAP_CC_UNSPECIFIED_ERROR},
 };
 
 static int hiomap_xlate_errno(int err)
@@ -111,14 +255,137 @@ static int hiomap_xlate_errno(int err)
     return entry->cc;
 }
 
-static void ipmi_hiomap_event_response(IpmiCmdData cmd, bool status)
+static uint64_t hiomap_now_us()
 {
-    using namespace phosphor::logging;
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static int hiomap_send_events(sd_event_source* source, uint64_t usec,
+                              void* userdata)
+{
+    struct hiomap* ctx = static_cast<struct hiomap*>(userdata);
+
+    /* Whatever the state is now covers every update since arming */
+    ctx->stats.events_sent++;
+    ctx->notify(ctx, ctx->bmc_events);
+
+    return 0;
+}
+
+/*
+ * hiomapd's signals tend to come in bursts, e.g. a WindowReset alongside a
+ * ProtocolReset. Hold the update back briefly so a burst costs the host one
+ * attention rather than several.
+ */
+static void hiomap_notify_events(struct hiomap* ctx)
+{
+    uint32_t window = hiomap_settings_get(&ctx->settings)->event_coalesce_max;
+    uint64_t now;
+    int enabled;
+
+    if (!window)
+    {
+        sd_event_source_set_enabled(ctx->event_timer, SD_EVENT_OFF);
+        hiomap_send_events(ctx->event_timer, 0, ctx);
+        return;
+    }
+
+    /* An update already pending will carry this one too */
+    sd_event_source_get_enabled(ctx->event_timer, &enabled);
+    if (enabled != SD_EVENT_OFF)
+    {
+        return;
+    }
+
+    sd_event_now(ctx->event, CLOCK_MONOTONIC, &now);
+    sd_event_source_set_time(ctx->event_timer, now + window);
+    sd_event_source_set_enabled(ctx->event_timer, SD_EVENT_ONESHOT);
+}
+
+void hiomap_event_failed(struct hiomap* ctx)
+{
+    ctx->stats.events_failed++;
+}
+
+/* Pollers use the generation to detect transitions they did not observe */
+static void hiomap_set_events(struct hiomap* ctx, uint8_t events)
+{
+    if (ctx->bmc_events != events)
+    {
+        ctx->bmc_events = events;
+        ctx->event_generation++;
+    }
+}
+
+/* Record a window-relative range the host has modified */
+static void hiomap_window_modified(struct hiomap* ctx, uint16_t offset,
+                                   uint16_t size)
+{
+    /* Without the block size we can't locate the range, so drop everything */
+    if (!ctx->block_size_shift)
+    {
+        hiomap_shadow_invalidate(&ctx->shadow, 0, ctx->backend.size);
+        hiomap_backend_invalidate(&ctx->backend, 0, ctx->backend.size);
+        return;
+    }
+
+    uint32_t start = uint32_t(ctx->window.offset + offset)
+                     << ctx->block_size_shift;
+    uint32_t len = uint32_t(size) << ctx->block_size_shift;
+
+    ctx->dirty.emplace_back(start, len);
+    hiomap_shadow_invalidate(&ctx->shadow, start, len);
+    hiomap_backend_invalidate(&ctx->backend, start, len);
+}
+
+/* Whether the shadow should be loaded */
+static bool hiomap_shadow_wanted(struct hiomap* ctx)
+{
+    auto settings = hiomap_settings_get(&ctx->settings);
+
+    return settings->flash_shadow &&
+           !(settings->host_power_aware && ctx->host_off);
+}
+
+/* Point the shadow at the shared store, or not. Call while released. */
+static void hiomap_shadow_share(struct hiomap* ctx)
+{
+    bool shared = hiomap_settings_get(&ctx->settings)->shared_shadow;
+
+    ctx->shadow.store = shared && ctx->store.dirfd >= 0 ? &ctx->store : NULL;
+}
+
+/* hiomapd has written the modified ranges back to flash */
+static void hiomap_window_flushed(struct hiomap* ctx)
+{
+    /* The loader may have picked up the old contents in the meantime */
+    for (const auto& range : ctx->dirty)
+    {
+        hiomap_shadow_invalidate(&ctx->shadow, range.first, range.second);
+        hiomap_backend_invalidate(&ctx->backend, range.first, range.second);
+    }
+    ctx->dirty.clear();
+
+    if (hiomap_shadow_wanted(ctx))
+    {
+        hiomap_shadow_start(&ctx->shadow);
+    }
+}
+
+/*
+ * The flash may be modified behind hiomapd's back while it has lost control
+ * of it, e.g. during a BMC-side PNOR update, so the shadow can't be trusted.
+ */
+static void hiomap_flash_control_changed(struct hiomap* ctx, bool lost)
+{
+    hiomap_shadow_release(&ctx->shadow);
+    hiomap_backend_invalidate(&ctx->backend, 0, ctx->backend.size);
 
-    if (!status)
+    if (!lost && hiomap_shadow_wanted(ctx))
     {
-        log<level::ERR>("Failed to deliver host command",
-                        entry("SEL_COMMAND=%x:%x", cmd.first, cmd.second));
+        hiomap_shadow_start(&ctx->shadow);
     }
 }
 
@@ -130,6 +397,8 @@ static int hiomap_handle_property_update(struct hiomap* ctx,
     std::string iface;
     msg.read(iface, msgData);
 
+    uint8_t events = ctx->bmc_events;
+
     for (auto const& x : msgData)
     {
         if (!ctx->event_lookup.count(x.first))
@@ -143,17 +412,37 @@ static int hiomap_handle_property_update(struct hiomap* ctx,
 
         if (value)
         {
-            ctx->bmc_events |= mask;
+            events |= mask;
         }
         else
         {
-            ctx->bmc_events &= ~mask;
+            events &= ~mask;
+        }
+    }
+
+    /* A restarted hiomapd has forgotten our suspends */
+    if ((events ^ ctx->bmc_events) & BMC_EVENT_DAEMON_READY)
+    {
+        ctx->own_suspends = 0;
+    }
+
+    if ((events ^ ctx->bmc_events) & BMC_EVENT_FLASH_CTRL_LOST)
+    {
+        bool lost = events & BMC_EVENT_FLASH_CTRL_LOST;
+
+        if (!ctx->own_suspends)
+        {
+            hiomap_flash_control_changed(ctx, lost);
+        }
+        else if (!lost)
+        {
+            ctx->own_suspends--;
         }
     }
 
-    auto cmd = std::make_pair(IPMI_CMD_HIOMAP_EVENT, ctx->bmc_events);
+    hiomap_set_events(ctx, events);
 
-    ipmid_send_cmd_to_host(std::make_tuple(cmd, ipmi_hiomap_event_response));
+    hiomap_notify_events(ctx);
 
     return 0;
 }
@@ -170,13 +459,131 @@ static bus::match::match hiomap_match_properties(struct hiomap* ctx)
     return match;
 }
 
+/* Nothing will use the caches until the host is back, so free the memory */
+static void hiomap_host_powered_off(struct hiomap* ctx)
+{
+    ctx->host_off = true;
+
+    if (!hiomap_settings_get(&ctx->settings)->host_power_aware)
+    {
+        return;
+    }
+
+    hiomap_shadow_release(&ctx->shadow);
+    hiomap_backend_invalidate(&ctx->backend, 0, ctx->backend.size);
+}
+
+/*
+ * Power sequencing takes a while before the host asks for flash, so start
+ * loading what it read last boot, in the order it read it.
+ */
+static void hiomap_host_powering_on(struct hiomap* ctx)
+{
+    ctx->host_off = false;
+
+    if (!ctx->boot_blocks.empty())
+    {
+        hiomap_shadow_prioritise(&ctx->shadow, ctx->boot_blocks);
+    }
+
+    /* Learn afresh from this boot */
+    std::fill(ctx->boot_seen.begin(), ctx->boot_seen.end(), false);
+    ctx->boot_blocks.clear();
+
+    if (hiomap_shadow_wanted(ctx))
+    {
+        hiomap_shadow_start(&ctx->shadow);
+    }
+}
+
+static int hiomap_handle_host_state(struct hiomap* ctx,
+                                    sdbusplus::message::message& msg)
+{
+    std::map<std::string, sdbusplus::message::variant<std::string>> msgData;
+
+    std::string iface;
+    msg.read(iface, msgData);
+
+    for (auto const& x : msgData)
+    {
+        auto value = sdbusplus::message::variant_ns::get<std::string>(x.second);
+
+        if (x.first == "CurrentHostState")
+        {
+            bool off = value == HOST_STATE_OFF;
+
+            if (off && !ctx->host_off)
+            {
+                hiomap_host_powered_off(ctx);
+            }
+            else if (!off && ctx->host_off)
+            {
+                /* We missed the transition request */
+                hiomap_host_powering_on(ctx);
+            }
+        }
+        else if (x.first == "RequestedHostTransition")
+        {
+            bool on = value == HOST_TRANSITION_ON ||
+                      value == HOST_TRANSITION_REBOOT;
+
+            if (on && ctx->host_off)
+            {
+                hiomap_host_powering_on(ctx);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static bus::match::match hiomap_match_host_state(struct hiomap* ctx)
+{
+    auto properties = bus::match::rules::propertiesChanged(HOST_STATE_OBJECT,
+                                                           HOST_STATE_IFACE);
+
+    bus::match::match match(
+        *ctx->bus, properties,
+        std::bind(hiomap_handle_host_state, ctx, std::placeholders::_1));
+
+    return match;
+}
+
+/* Without a host state manager, behave as if the host is always on */
+static bool hiomap_query_host_off(struct hiomap* ctx)
+{
+    auto m = ctx->bus->new_method_call(HOST_STATE_SERVICE, HOST_STATE_OBJECT,
+                                       DBUS_IFACE_PROPERTIES, "Get");
+    m.append(HOST_STATE_IFACE, "CurrentHostState");
+
+    try
+    {
+        auto reply = ctx->bus->call(m);
+
+        sdbusplus::message::variant<std::string> state;
+        reply.read(state);
+
+        return sdbusplus::message::variant_ns::get<std::string>(state) ==
+               HOST_STATE_OFF;
+    }
+    catch (const exception::SdBusError& e)
+    {
+        return false;
+    }
+}
+
 static int hiomap_handle_signal_v2(struct hiomap* ctx, const char* name)
 {
-    ctx->bmc_events |= ctx->event_lookup[name];
+    /* Both WindowReset and ProtocolReset invalidate the active window */
+    ctx->window.open = false;
 
-    auto cmd = std::make_pair(IPMI_CMD_HIOMAP_EVENT, ctx->bmc_events);
+    /* Along with any changes to it hiomapd hasn't heard about */
+    ctx->writeback.held.clear();
+    sd_event_source_set_enabled(ctx->writeback.step, SD_EVENT_OFF);
 
-    ipmid_send_cmd_to_host(std::make_tuple(cmd, ipmi_hiomap_event_response));
+    hiomap_set_events(ctx, ctx->bmc_events | ctx->event_lookup[name]);
+
+    hiomap_notify_events(ctx);
 
     return 0;
 }
@@ -195,43 +602,76 @@ static bus::match::match hiomap_match_signal_v2(struct hiomap* ctx,
     return match;
 }
 
-static ipmi_ret_t hiomap_reset(ipmi_request_t request, ipmi_response_t response,
-                               ipmi_data_len_t data_len, ipmi_context_t context)
+static int hiomap_reset(struct hiomap* ctx, const uint8_t* req,
+                        size_t req_len, uint8_t* resp, size_t* resp_len)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
     auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
                                        HIOMAPD_IFACE, "Reset");
     try
     {
         ctx->bus->call(m);
 
-        *data_len = 0;
+        ctx->window.open = false;
+
+        *resp_len = 0;
     }
     catch (const exception::SdBusError& e)
     {
         return hiomap_xlate_errno(e.get_errno());
     }
 
-    return IPMI_CC_OK;
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Note a Flush or Erase that hiomapd carried out, whether for the host or
+ * for an idle flush or write-back step
+ */
+static void hiomap_writeback_record(struct hiomap* ctx, uint64_t us)
+{
+    hiomap_writeback_latency_record(&ctx->writeback_latency,
+                                    hiomap_settings_get(&ctx->settings).get(),
+                                    us);
 }
 
-static ipmi_ret_t hiomap_get_info(ipmi_request_t request,
-                                  ipmi_response_t response,
-                                  ipmi_data_len_t data_len,
-                                  ipmi_context_t context)
+/*
+ * hiomapd reports a fixed timeout that is unaware of load. Once we have seen
+ * enough write-back operations, suggest a timeout derived from the tail of
+ * the recent Flush and Erase latencies instead, but never less than
+ * hiomapd's own: most write-back happens in the background, so a quiet tail
+ * doesn't mean the host's next Flush will be quick.
+ */
+static uint16_t hiomap_suggest_timeout(struct hiomap* ctx, uint16_t timeout)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
+    auto settings = hiomap_settings_get(&ctx->settings);
+    const struct hiomap_histogram* hist = &ctx->writeback_latency;
+
+    if (!settings->adaptive_timeout ||
+        hist->count < settings->timeout_min_samples)
+    {
+        return timeout;
+    }
+
+    uint64_t tail = hiomap_histogram_quantile(hist, 0.99);
+    uint64_t suggested = (tail * settings->timeout_margin + 999999) / 1000000;
+
+    suggested = std::clamp<uint64_t>(suggested, settings->timeout_min,
+                                     settings->timeout_max);
+
+    return std::max<uint64_t>(suggested, timeout);
+}
 
-    if (*data_len < 1)
+static int hiomap_get_info(struct hiomap* ctx, const uint8_t* req,
+                           size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 1)
     {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
     }
 
-    uint8_t* reqdata = (uint8_t*)request;
     auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
                                        HIOMAPD_IFACE, "GetInfo");
-    m.append(reqdata[0]);
+    m.append(req[0]);
 
     try
     {
@@ -242,30 +682,27 @@ static ipmi_ret_t hiomap_get_info(ipmi_request_t request,
         uint16_t timeout;
         reply.read(version, blockSizeShift, timeout);
 
-        uint8_t* respdata = (uint8_t*)response;
+        ctx->block_size_shift = blockSizeShift;
 
         /* FIXME: Assumes v2! */
-        put(&respdata[0], version);
-        put(&respdata[1], blockSizeShift);
-        put(&respdata[2], htole16(timeout));
+        put(&resp[0], version);
+        put(&resp[1], blockSizeShift);
+        put(&resp[2], htole16(hiomap_suggest_timeout(ctx, timeout)));
 
-        *data_len = 4;
+        *resp_len = 4;
     }
     catch (const exception::SdBusError& e)
     {
         return hiomap_xlate_errno(e.get_errno());
     }
 
-    return IPMI_CC_OK;
+    return HIOMAP_CC_OK;
 }
 
-static ipmi_ret_t hiomap_get_flash_info(ipmi_request_t request,
-                                        ipmi_response_t response,
-                                        ipmi_data_len_t data_len,
-                                        ipmi_context_t context)
+static int hiomap_get_flash_info(struct hiomap* ctx, const uint8_t* req,
+                                 size_t req_len, uint8_t* resp,
+                                 size_t* resp_len)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
     auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
                                        HIOMAPD_IFACE_V2, "GetFlashInfo");
     try
@@ -275,244 +712,1163 @@ static ipmi_ret_t hiomap_get_flash_info(ipmi_request_t request,
         uint16_t flashSize, eraseSize;
         reply.read(flashSize, eraseSize);
 
-        uint8_t* respdata = (uint8_t*)response;
-        put(&respdata[0], htole16(flashSize));
-        put(&respdata[2], htole16(eraseSize));
+        ctx->flash_size = flashSize;
+        ctx->erase_size = eraseSize;
+
+        put(&resp[0], htole16(flashSize));
+        put(&resp[2], htole16(eraseSize));
 
-        *data_len = 4;
+        *resp_len = 4;
     }
     catch (const exception::SdBusError& e)
     {
         return hiomap_xlate_errno(e.get_errno());
     }
 
-    return IPMI_CC_OK;
+    return HIOMAP_CC_OK;
 }
 
-static ipmi_ret_t hiomap_create_window(struct hiomap* ctx, bool ro,
-                                       ipmi_request_t request,
-                                       ipmi_response_t response,
-                                       ipmi_data_len_t data_len)
+/*
+ * The protocol allows us to return a larger window than the host asked for.
+ * Once the host is walking forward through flash, ask hiomapd for a window
+ * of the configured size so the stream needs fewer CreateReadWindow calls.
+ */
+static uint16_t hiomap_inflate_window(struct hiomap* ctx, uint16_t offset,
+                                      uint16_t size)
 {
-    if (*data_len < 4)
-    {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
-    }
+    return hiomap_readahead_size(
+        &ctx->readahead, hiomap_settings_get(&ctx->settings).get(),
+        ctx->block_size_shift, ctx->flash_size, offset, size);
+}
 
-    uint8_t* reqdata = (uint8_t*)request;
+static message::message hiomap_call_create_window(struct hiomap* ctx, bool ro,
+                                                  uint16_t offset,
+                                                  uint16_t size)
+{
     auto windowType = ro ? "CreateReadWindow" : "CreateWriteWindow";
 
     auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
                                        HIOMAPD_IFACE_V2, windowType);
-    m.append(le16toh(get<uint16_t>(&reqdata[0])));
-    m.append(le16toh(get<uint16_t>(&reqdata[2])));
+    m.append(offset);
+    m.append(size);
+
+    return ctx->bus->call(m);
+}
+
+/* Remember the erase blocks the host needs while booting */
+static void hiomap_boot_access(struct hiomap* ctx, uint16_t offset,
+                               uint16_t size)
+{
+    uint32_t erase_size = ctx->backend.erase_size;
+
+    if (!ctx->block_size_shift || !erase_size || !size)
+    {
+        return;
+    }
+
+    uint64_t start = uint64_t(offset) << ctx->block_size_shift;
+    uint64_t end = start + (uint64_t(size) << ctx->block_size_shift);
+
+    for (uint64_t i = start / erase_size;
+         i < ctx->boot_seen.size() && i * erase_size < end; i++)
+    {
+        if (!ctx->boot_seen[i])
+        {
+            ctx->boot_seen[i] = true;
+            ctx->boot_blocks.push_back(i);
+        }
+    }
+}
+
+static int hiomap_create_window(struct hiomap* ctx, bool ro,
+                                const uint8_t* req, size_t req_len,
+                                uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 4)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    uint16_t reqOffset = le16toh(get<uint16_t>(&req[0]));
+    uint16_t reqSize = le16toh(get<uint16_t>(&req[2]));
+    uint16_t inflated = ro ? hiomap_inflate_window(ctx, reqOffset, reqSize)
+                           : reqSize;
+
+    /* Assume the active window is gone until hiomapd tells us otherwise */
+    ctx->window.open = false;
 
     try
     {
-        auto reply = ctx->bus->call(m);
+        message::message reply;
+
+        try
+        {
+            reply = hiomap_call_create_window(ctx, ro, reqOffset, inflated);
+        }
+        catch (const exception::SdBusError& e)
+        {
+            /* hiomapd may refuse the larger window, so fall back */
+            if (inflated == reqSize)
+            {
+                throw;
+            }
+
+            inflated = reqSize;
+            reply = hiomap_call_create_window(ctx, ro, reqOffset, reqSize);
+        }
 
         uint16_t lpcAddress, size, offset;
         reply.read(lpcAddress, size, offset);
 
-        uint8_t* respdata = (uint8_t*)response;
+        if (inflated != reqSize)
+        {
+            ctx->stats.windows_inflated++;
+        }
+
+        ctx->window.open = true;
+        ctx->window.ro = ro;
+        ctx->window.offset = offset;
+        ctx->window.size = size;
+
+        hiomap_boot_access(ctx, reqOffset, reqSize);
+
+        if (ro)
+        {
+            ctx->readahead.next = offset + size;
+        }
 
         /* FIXME: Assumes v2! */
-        put(&respdata[0], htole16(lpcAddress));
-        put(&respdata[2], htole16(size));
-        put(&respdata[4], htole16(offset));
+        put(&resp[0], htole16(lpcAddress));
+        put(&resp[2], htole16(size));
+        put(&resp[4], htole16(offset));
 
-        *data_len = 6;
+        *resp_len = 6;
     }
     catch (const exception::SdBusError& e)
     {
         return hiomap_xlate_errno(e.get_errno());
     }
 
-    return IPMI_CC_OK;
+    return HIOMAP_CC_OK;
 }
 
-static ipmi_ret_t hiomap_create_read_window(ipmi_request_t request,
-                                            ipmi_response_t response,
-                                            ipmi_data_len_t data_len,
-                                            ipmi_context_t context)
+static int hiomap_create_read_window(struct hiomap* ctx, const uint8_t* req,
+                                     size_t req_len, uint8_t* resp,
+                                     size_t* resp_len)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
-    return hiomap_create_window(ctx, true, request, response, data_len);
+    return hiomap_create_window(ctx, true, req, req_len, resp, resp_len);
 }
 
-static ipmi_ret_t hiomap_create_write_window(ipmi_request_t request,
-                                             ipmi_response_t response,
-                                             ipmi_data_len_t data_len,
-                                             ipmi_context_t context)
+static int hiomap_create_write_window(struct hiomap* ctx, const uint8_t* req,
+                                      size_t req_len, uint8_t* resp,
+                                      size_t* resp_len)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
-    return hiomap_create_window(ctx, false, request, response, data_len);
+    return hiomap_create_window(ctx, false, req, req_len, resp, resp_len);
 }
 
-static ipmi_ret_t hiomap_close_window(ipmi_request_t request,
-                                      ipmi_response_t response,
-                                      ipmi_data_len_t data_len,
-                                      ipmi_context_t context)
+static int hiomap_close_window(struct hiomap* ctx, const uint8_t* req,
+                               size_t req_len, uint8_t* resp, size_t* resp_len)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
-    if (*data_len < 1)
+    if (req_len < 1)
     {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
     }
 
-    uint8_t* reqdata = (uint8_t*)request;
     auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
                                        HIOMAPD_IFACE_V2, "CloseWindow");
-    m.append(reqdata[0]);
+    m.append(req[0]);
 
     try
     {
         auto reply = ctx->bus->call(m);
 
-        *data_len = 0;
+        /* Closing a write window implicitly flushes it */
+        if (!ctx->window.ro)
+        {
+            hiomap_window_flushed(ctx);
+        }
+
+        ctx->window.open = false;
+
+        *resp_len = 0;
     }
     catch (const exception::SdBusError& e)
     {
         return hiomap_xlate_errno(e.get_errno());
     }
 
-    return IPMI_CC_OK;
+    return HIOMAP_CC_OK;
 }
 
-static ipmi_ret_t hiomap_mark_dirty(ipmi_request_t request,
-                                    ipmi_response_t response,
-                                    ipmi_data_len_t data_len,
-                                    ipmi_context_t context)
+struct hiomap_pipeline_call
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
-    if (*data_len < 4)
-    {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
-    }
-
-    uint8_t* reqdata = (uint8_t*)request;
-    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
-                                       HIOMAPD_IFACE_V2, "MarkDirty");
-    /* FIXME: Assumes v2 */
-    m.append(le16toh(get<uint16_t>(&reqdata[0]))); /* offset */
-    m.append(le16toh(get<uint16_t>(&reqdata[2]))); /* size */
+    sd_bus_slot* slot;
+    bool done;
+    int rc;
+};
 
-    try
-    {
-        auto reply = ctx->bus->call(m);
+static int hiomap_pipeline_reply(sd_bus_message* m, void* userdata,
+                                 sd_bus_error* error)
+{
+    auto call = static_cast<struct hiomap_pipeline_call*>(userdata);
 
-        *data_len = 0;
-    }
-    catch (const exception::SdBusError& e)
-    {
-        return hiomap_xlate_errno(e.get_errno());
-    }
+    call->done = true;
+    call->rc = -sd_bus_message_get_errno(m);
 
-    return IPMI_CC_OK;
+    return 0;
 }
 
-static ipmi_ret_t hiomap_flush(ipmi_request_t request, ipmi_response_t response,
-                               ipmi_data_len_t data_len, ipmi_context_t context)
+/*
+ * Send the queued calls back to back, then collect the replies. hiomapd
+ * handles them in the order sent, so the outcome is that of calling it for
+ * each in turn, but with one round trip instead of many.
+ *
+ * Returns the completion code of the first failure not yet reported to the
+ * host.
+ */
+static int hiomap_pipeline_drain(struct hiomap* ctx)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
-
-    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
-                                       HIOMAPD_IFACE_V2, "Flush");
+    auto& pipeline = ctx->pipeline;
+    std::vector<struct hiomap_pipeline_call> calls(pipeline.queue.size());
+    int rc = 0;
 
-    try
+    if (pipeline.queue.empty())
     {
-        /* FIXME: No argument call assumes v2 */
-        auto reply = ctx->bus->call(m);
-
-        *data_len = 0;
+        return pipeline.error;
     }
-    catch (const exception::SdBusError& e)
+
+    for (size_t i = 0; i < calls.size(); i++)
     {
-        return hiomap_xlate_errno(e.get_errno());
-    }
+        const char* method = std::get<0>(pipeline.queue[i]);
+        sd_bus_message* m = NULL;
 
-    return IPMI_CC_OK;
-}
+        rc = sd_bus_message_new_method_call(pipeline.bus, &m, HIOMAPD_SERVICE,
+                                            HIOMAPD_OBJECT, HIOMAPD_IFACE_V2,
+                                            method);
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_append(m, "qq", std::get<1>(pipeline.queue[i]),
+                                       std::get<2>(pipeline.queue[i]));
+        }
 
-static ipmi_ret_t hiomap_ack(ipmi_request_t request, ipmi_response_t response,
-                             ipmi_data_len_t data_len, ipmi_context_t context)
-{
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
+        if (rc >= 0)
+        {
+            rc = sd_bus_call_async(pipeline.bus, &calls[i].slot, m,
+                                   hiomap_pipeline_reply, &calls[i], 0);
+        }
 
-    if (*data_len < 1)
-    {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
+        sd_bus_message_unref(m);
+
+        if (rc < 0)
+        {
+            calls[i].done = true;
+            calls[i].rc = rc;
+        }
     }
 
-    uint8_t* reqdata = (uint8_t*)request;
-    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
-                                       HIOMAPD_IFACE_V2, "Ack");
-    auto acked = reqdata[0];
-    m.append(acked);
+    pipeline.queue.clear();
 
+    auto outstanding = [&calls]() {
+        return std::any_of(
+            calls.begin(), calls.end(),
+            [](const struct hiomap_pipeline_call& call) { return !call.done; });
+    };
+
+    while (outstanding())
+    {
+        rc = sd_bus_process(pipeline.bus, NULL);
+        if (rc > 0)
+        {
+            continue;
+        }
+
+        if (rc == 0)
+        {
+            /* Method call timeouts bound the wait */
+            rc = sd_bus_wait(pipeline.bus, UINT64_MAX);
+        }
+
+        if (rc < 0)
+        {
+            break;
+        }
+    }
+
+    for (auto& call : calls)
+    {
+        /* Dropping the slot cancels the callback if we gave up waiting */
+        sd_bus_slot_unref(call.slot);
+
+        if (!call.done)
+        {
+            call.rc = rc;
+        }
+
+        if (call.rc < 0 && pipeline.error == HIOMAP_CC_OK)
+        {
+            pipeline.error = hiomap_xlate_errno(-call.rc);
+        }
+    }
+
+    return pipeline.error;
+}
+
+/*
+ * Acknowledge a MarkDirty straight away and send it to hiomapd with those
+ * that follow.
+ */
+static bool hiomap_pipeline_queue(struct hiomap* ctx, const char* method,
+                                  uint16_t offset, uint16_t size, int* cc)
+{
+    uint32_t depth = hiomap_settings_get(&ctx->settings)->pipeline_depth;
+
+    if (!depth || !ctx->pipeline.bus)
+    {
+        return false;
+    }
+
+    ctx->pipeline.queue.emplace_back(method, offset, size);
+    ctx->stats.pipelined_calls++;
+    hiomap_window_modified(ctx, offset, size);
+
+    *cc = HIOMAP_CC_OK;
+    if (ctx->pipeline.queue.size() >= depth)
+    {
+        *cc = hiomap_pipeline_drain(ctx);
+        ctx->pipeline.error = HIOMAP_CC_OK;
+    }
+
+    return true;
+}
+
+/* Call hiomapd's MarkDirty or Erase on a range of the active window */
+static int hiomap_call_range(struct hiomap* ctx, const char* method,
+                             uint16_t offset, uint16_t size)
+{
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_V2, method);
+    m.append(offset);
+    m.append(size);
+
+    try
+    {
+        ctx->bus->call(m);
+    }
+    catch (const exception::SdBusError& e)
+    {
+        return hiomap_xlate_errno(e.get_errno());
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Acknowledge a MarkDirty straight away, but only tell hiomapd as the range
+ * is written back or something else needs the window.
+ */
+static bool hiomap_writeback_hold(struct hiomap* ctx, uint16_t offset,
+                                  uint16_t size)
+{
+    if (!hiomap_writeback_should_hold(
+            hiomap_settings_get(&ctx->settings).get(), ctx->window.open,
+            ctx->window.ro, ctx->window.size, offset, size))
+    {
+        return false;
+    }
+
+    ctx->writeback.held.emplace_back(offset, size);
+    hiomap_window_modified(ctx, offset, size);
+
+    return true;
+}
+
+/* Hand all held ranges to hiomapd, abandoning any write-back in progress */
+static int hiomap_writeback_release(struct hiomap* ctx)
+{
+    uint32_t depth = hiomap_settings_get(&ctx->settings)->pipeline_depth;
+    int cc = HIOMAP_CC_OK;
+
+    sd_event_source_set_enabled(ctx->writeback.step, SD_EVENT_OFF);
+
+    /* Send them back to back when pipelining, as the host would have */
+    if (depth && ctx->pipeline.bus && !ctx->writeback.held.empty())
+    {
+        for (const auto& range : ctx->writeback.held)
+        {
+            ctx->pipeline.queue.emplace_back("MarkDirty", range.first,
+                                             range.second);
+            ctx->stats.pipelined_calls++;
+        }
+        ctx->writeback.held.clear();
+
+        cc = hiomap_pipeline_drain(ctx);
+        ctx->pipeline.error = HIOMAP_CC_OK;
+
+        return cc;
+    }
+
+    for (const auto& range : ctx->writeback.held)
+    {
+        int rc = hiomap_call_range(ctx, "MarkDirty", range.first, range.second);
+        if (cc == HIOMAP_CC_OK)
+        {
+            cc = rc;
+        }
+    }
+    ctx->writeback.held.clear();
+
+    return cc;
+}
+
+/*
+ * Write back the held ranges an erase block at a time. Steps run at idle
+ * priority, so any host command that arrives meanwhile is handled first and
+ * only waits for the block in progress.
+ */
+static int hiomap_writeback_step(sd_event_source* source, void* userdata)
+{
+    using namespace phosphor::logging;
+
+    struct hiomap* ctx = static_cast<struct hiomap*>(userdata);
+    auto& held = ctx->writeback.held;
+
+    if (held.empty())
+    {
+        sd_event_source_set_enabled(source, SD_EVENT_OFF);
+        return 0;
+    }
+
+    uint16_t offset = held.front().first;
+    uint16_t size = held.front().second;
+
+    /* Stop at the end of the erase block the range starts in */
+    uint32_t chunk = std::max<uint16_t>(ctx->erase_size, 1);
+    uint32_t start = uint32_t(ctx->window.offset) + offset;
+    uint16_t len = std::min<uint32_t>(size, chunk - start % chunk);
+
+    uint64_t begin = hiomap_now_us();
+    int cc = hiomap_call_range(ctx, "MarkDirty", offset, len);
+    if (cc == HIOMAP_CC_OK)
+    {
+        if (len == size)
+        {
+            held.erase(held.begin());
+        }
+        else
+        {
+            held.front() = std::make_pair(offset + len, size - len);
+        }
+
+        auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                           HIOMAPD_IFACE_V2, "Flush");
+        try
+        {
+            ctx->bus->call(m);
+
+            hiomap_writeback_record(ctx, hiomap_now_us() - begin);
+        }
+        catch (const exception::SdBusError& e)
+        {
+            cc = hiomap_xlate_errno(e.get_errno());
+        }
+    }
+
+    if (cc != HIOMAP_CC_OK)
+    {
+        /* The host's own Flush will send what's left and see the error */
+        log<level::INFO>("Chunked write-back of the host write window failed",
+                         entry("CC=0x%x", cc));
+        sd_event_source_set_enabled(source, SD_EVENT_OFF);
+        return 0;
+    }
+
+    if (held.empty())
+    {
+        hiomap_window_flushed(ctx);
+        ctx->stats.idle_flushes++;
+        sd_event_source_set_enabled(source, SD_EVENT_OFF);
+    }
+
+    return 0;
+}
+
+/* Whether a command can be handled while ranges are held from hiomapd */
+static int hiomap_mark_dirty(struct hiomap* ctx, const uint8_t* req,
+                             size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 4)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    /* FIXME: Assumes v2 */
+    uint16_t offset = le16toh(get<uint16_t>(&req[0]));
+    uint16_t size = le16toh(get<uint16_t>(&req[2]));
+    int cc;
+
+    *resp_len = 0;
+
+    if (hiomap_writeback_hold(ctx, offset, size))
+    {
+        return HIOMAP_CC_OK;
+    }
+
+    if (hiomap_mark_dirty_pipelines(
+            hiomap_settings_get(&ctx->settings).get()) &&
+        hiomap_pipeline_queue(ctx, "MarkDirty", offset, size, &cc))
+    {
+        return cc;
+    }
+
+    cc = hiomap_call_range(ctx, "MarkDirty", offset, size);
+    if (cc == HIOMAP_CC_OK)
+    {
+        hiomap_window_modified(ctx, offset, size);
+    }
+
+    return cc;
+}
+
+static int hiomap_flush(struct hiomap* ctx, const uint8_t* req,
+                        size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_V2, "Flush");
+
+    try
+    {
+        /* FIXME: No argument call assumes v2 */
+        auto reply = ctx->bus->call(m);
+
+        hiomap_window_flushed(ctx);
+
+        *resp_len = 0;
+    }
+    catch (const exception::SdBusError& e)
+    {
+        return hiomap_xlate_errno(e.get_errno());
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+static int hiomap_ack(struct hiomap* ctx, const uint8_t* req,
+                      size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 1)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    /* Our own events are unknown to hiomapd */
+    uint8_t acked = req[0];
+    uint8_t own = acked & HIOMAP_EVENT_OEM_DELTA_APPLIED;
+    if (acked == own)
+    {
+        hiomap_set_events(ctx, ctx->bmc_events & ~acked);
+        *resp_len = 0;
+
+        return HIOMAP_CC_OK;
+    }
+
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_V2, "Ack");
+    m.append(static_cast<uint8_t>(acked & ~own));
+
+    try
+    {
+        auto reply = ctx->bus->call(m);
+
+        /* Update our cache: Necessary because the signals do not carry a value
+         */
+        hiomap_set_events(ctx, ctx->bmc_events & ~acked);
+
+        *resp_len = 0;
+    }
+    catch (const exception::SdBusError& e)
+    {
+        return hiomap_xlate_errno(e.get_errno());
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+static int hiomap_erase(struct hiomap* ctx, const uint8_t* req,
+                        size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 4)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    /* FIXME: Assumes v2 */
+    uint16_t offset = le16toh(get<uint16_t>(&req[0]));
+    uint16_t size = le16toh(get<uint16_t>(&req[2]));
+    int cc;
+
+    *resp_len = 0;
+
+    /*
+     * Not deferred: hiomapd also clears the range in the window, and would
+     * do so over anything the host writes to it in the meantime.
+     */
+    cc = hiomap_call_range(ctx, "Erase", offset, size);
+    if (cc == HIOMAP_CC_OK)
+    {
+        hiomap_window_modified(ctx, offset, size);
+    }
+
+    return cc;
+}
+
+/*
+ * Let hosts that cannot rely on SMS attention poll for the event state. No
+ * D-Bus traffic is required as we track the state through hiomapd's signals.
+ */
+static int hiomap_oem_get_events(struct hiomap* ctx, const uint8_t* req,
+                                 size_t req_len, uint8_t* resp,
+                                 size_t* resp_len)
+{
+    put(&resp[0], ctx->bmc_events);
+    put(&resp[1], htole32(ctx->event_generation));
+
+    *resp_len = 5;
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Whether the provider's view of [offset, offset + len) in flash may be out of
+ * date, because the host has changes in flight or hiomapd has given up the
+ * flash.
+ */
+static bool hiomap_flash_busy(struct hiomap* ctx, uint32_t offset,
+                              uint32_t len)
+{
+    uint64_t end = uint64_t(offset) + len;
+
+    if (ctx->bmc_events & BMC_EVENT_FLASH_CTRL_LOST)
+    {
+        return true;
+    }
+
+    for (const auto& range : ctx->dirty)
+    {
+        if (range.first < end && offset < uint64_t(range.first) + range.second)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Return a few bytes of flash directly in the response, sparing the host a
+ * window switch for lookups such as the FFS header. Served from the shadow
+ * where possible, without touching the host's active window.
+ */
+static int hiomap_oem_read(struct hiomap* ctx, const uint8_t* req,
+                           size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 5)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    uint32_t offset = le32toh(get<uint32_t>(&req[0])); /* bytes */
+    uint8_t len = req[4];
+
+    if (!len || len > *resp_len)
+    {
+        return HIOMAP_CC_PARM_OUT_OF_RANGE;
+    }
+
+    /* The flash doesn't yet hold what the host would read via a window */
+    if (hiomap_flash_busy(ctx, offset, len))
+    {
+        return HIOMAP_CC_BUSY;
+    }
+
+    int rc = hiomap_shadow_read(&ctx->shadow, offset, resp, len);
+    if (rc < 0)
+    {
+        return hiomap_xlate_errno(-rc);
+    }
+
+    *resp_len = len;
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Take the flash from hiomapd before writing it directly, so that it neither
+ * loads windows from flash we are part way through changing nor writes the
+ * host's changes back over ours. The host sees FlashControlLost meanwhile.
+ */
+static int hiomap_flash_suspend(struct hiomap* ctx)
+{
+    using namespace phosphor::logging;
+
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_CONTROL, "Suspend");
+    try
+    {
+        ctx->bus->call(m);
+    }
+    catch (const exception::SdBusError& e)
+    {
+        /* Not counted: if it did suspend, we just lose the caches */
+        log<level::ERR>("Failed to suspend hiomapd",
+                        entry("ERRNO=%d", e.get_errno()));
+        return hiomap_xlate_errno(e.get_errno());
+    }
+
+    ctx->own_suspends++;
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Hand the flash back to hiomapd, telling it whether we changed it so that it
+ * drops its windows, and reload the shadow for whatever the caller
+ * invalidated
+ */
+static int hiomap_flash_resume(struct hiomap* ctx, bool modified)
+{
+    using namespace phosphor::logging;
+
+    if (modified && hiomap_shadow_wanted(ctx))
+    {
+        hiomap_shadow_start(&ctx->shadow);
+    }
+
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_CONTROL, "Resume");
+    m.append(modified);
     try
     {
-        auto reply = ctx->bus->call(m);
+        ctx->bus->call(m);
+    }
+    catch (const exception::SdBusError& e)
+    {
+        /*
+         * The host keeps seeing FlashControlLost until someone resumes, and
+         * that is no longer us, so treat it as anyone else's change.
+         */
+        log<level::ERR>("Failed to resume hiomapd",
+                        entry("ERRNO=%d", e.get_errno()));
+        if (ctx->own_suspends)
+        {
+            ctx->own_suspends--;
+        }
+        return hiomap_xlate_errno(e.get_errno());
+    }
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Apply a small write, such as an NVRAM update, straight to flash. This
+ * replaces opening a write window, writing over LPC, MarkDirty, Flush and
+ * reopening the previous window with a single command.
+ */
+static int hiomap_oem_write(struct hiomap* ctx, const uint8_t* req,
+                            size_t req_len, uint8_t* resp, size_t* resp_len)
+{
+    if (req_len < 5)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    uint32_t offset = le32toh(get<uint32_t>(&req[0])); /* bytes */
+    uint32_t len = req_len - 4;
+
+    /*
+     * hiomapd drops its windows once we tell it the flash changed, which
+     * would lose any host changes it has yet to write back.
+     */
+    if (!ctx->dirty.empty() || hiomap_flash_busy(ctx, offset, len))
+    {
+        return HIOMAP_CC_BUSY;
+    }
+
+    if (!hiomap_backend_ready(&ctx->backend))
+    {
+        return hiomap_xlate_errno(ENODEV);
+    }
+
+    int cc = hiomap_flash_suspend(ctx);
+    if (cc != HIOMAP_CC_OK)
+    {
+        return cc;
+    }
+
+    int rc = hiomap_backend_write(&ctx->backend, offset, &req[4], len);
+
+    /* Even a failed write may have changed the flash */
+    hiomap_shadow_invalidate(&ctx->shadow, offset, len);
+
+    cc = hiomap_flash_resume(ctx, true);
+    if (cc != HIOMAP_CC_OK)
+    {
+        return cc;
+    }
+
+    if (rc < 0)
+    {
+        return hiomap_xlate_errno(-rc);
+    }
+
+    *resp_len = 0;
+
+    return HIOMAP_CC_OK;
+}
+
+/* Forget the delta and any apply of it, returning its memory to the budget */
+static void hiomap_delta_discard(struct hiomap* ctx)
+{
+    auto& delta = ctx->delta;
+
+    delta.active = false;
+    delta.data = std::vector<uint8_t>();
+    delta.ops = std::vector<struct hiomap_backend_op>();
+    delta.order = std::vector<uint32_t>();
+    delta.blocks = std::vector<uint32_t>();
+
+    hiomap_budget_release(&delta.budget, delta.budget.used);
+}
+
+/*
+ * Begin receiving a delta of the given size, discarding any earlier one.
+ * Firmware updates then cost LPC bandwidth and flash wear in proportion to
+ * the size of the change rather than the size of the image.
+ */
+static int hiomap_oem_delta_start(struct hiomap* ctx, const uint8_t* req,
+                                  size_t req_len, uint8_t* resp,
+                                  size_t* resp_len)
+{
+    if (req_len < 4)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    if (ctx->delta.applying)
+    {
+        return HIOMAP_CC_BUSY;
+    }
+
+    uint32_t size = le32toh(get<uint32_t>(&req[0]));
+
+    /* An outcome the host didn't collect goes with the delta */
+    hiomap_delta_discard(ctx);
+    ctx->delta.done = false;
+    hiomap_set_events(ctx, ctx->bmc_events & ~HIOMAP_EVENT_OEM_DELTA_APPLIED);
+
+    if (size > HIOMAP_DELTA_MAX)
+    {
+        return HIOMAP_CC_NO_SPACE;
+    }
+
+    if (!hiomap_backend_ready(&ctx->backend))
+    {
+        return hiomap_xlate_errno(ENODEV);
+    }
+
+    if (!hiomap_budget_charge(&ctx->delta.budget, size))
+    {
+        return HIOMAP_CC_NO_SPACE;
+    }
+
+    ctx->delta.active = true;
+    ctx->delta.size = size;
+    ctx->delta.data.reserve(size);
+
+    *resp_len = 0;
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Append to the delta at the given position, responding with the number of
+ * bytes received so far. Resending data already received is harmless, so a
+ * host that lost a response can simply retry.
+ */
+static int hiomap_oem_delta_data(struct hiomap* ctx, const uint8_t* req,
+                                 size_t req_len, uint8_t* resp,
+                                 size_t* resp_len)
+{
+    if (req_len < 4 || *resp_len < 4)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    if (!ctx->delta.active)
+    {
+        return HIOMAP_CC_INVALID_FIELD_REQUEST;
+    }
+
+    auto& data = ctx->delta.data;
+    uint32_t pos = le32toh(get<uint32_t>(&req[0]));
+    uint64_t end = uint64_t(pos) + req_len - 4;
+
+    if (pos > data.size() || end > ctx->delta.size)
+    {
+        return HIOMAP_CC_PARM_OUT_OF_RANGE;
+    }
 
-        /* Update our cache: Necessary because the signals do not carry a value
-         */
-        ctx->bmc_events &= ~acked;
+    if (end > data.size())
+    {
+        data.insert(data.end(), &req[4] + (data.size() - pos), &req[req_len]);
+    }
 
-        *data_len = 0;
+    put(&resp[0], htole32(static_cast<uint32_t>(data.size())));
+    *resp_len = 4;
+
+    return HIOMAP_CC_OK;
+}
+
+/*
+ * Index the parsed records so each step can find those touching its erase
+ * block, and list the erase blocks touched. Returns the bytes this and the
+ * apply itself will hold.
+ */
+static uint64_t hiomap_delta_plan(struct hiomap* ctx)
+{
+    auto& delta = ctx->delta;
+    uint32_t erase_size = ctx->backend.erase_size;
+    /* Counting any partial block at the end of flash */
+    std::vector<bool> touched((uint64_t(ctx->backend.size) + erase_size - 1) /
+                              erase_size);
+
+    delta.order.resize(delta.ops.size());
+    for (uint32_t i = 0; i < delta.order.size(); i++)
+    {
+        const struct hiomap_backend_op& op = delta.ops[i];
+
+        delta.order[i] = i;
+        for (uint32_t block = op.offset / erase_size;
+             block < touched.size() &&
+             uint64_t(block) * erase_size < uint64_t(op.offset) + op.len;
+             block++)
+        {
+            touched[block] = true;
+        }
     }
-    catch (const exception::SdBusError& e)
+
+    std::stable_sort(delta.order.begin(), delta.order.end(),
+                     [&delta](uint32_t a, uint32_t b) {
+                         return delta.ops[a].offset < delta.ops[b].offset;
+                     });
+
+    for (uint32_t block = 0; block < touched.size(); block++)
     {
-        return hiomap_xlate_errno(e.get_errno());
+        if (touched[block])
+        {
+            delta.blocks.push_back(block * erase_size);
+        }
     }
 
-    return IPMI_CC_OK;
+    /* A step holds the old and new contents of its erase block */
+    return delta.ops.size() * sizeof(delta.ops[0]) +
+           delta.order.size() * sizeof(delta.order[0]) +
+           delta.blocks.size() * sizeof(delta.blocks[0]) + 2 * erase_size;
 }
 
-static ipmi_ret_t hiomap_erase(ipmi_request_t request, ipmi_response_t response,
-                               ipmi_data_len_t data_len, ipmi_context_t context)
+/* The records touching the erase block at base, in delta order */
+static void hiomap_delta_block_ops(struct hiomap* ctx, uint32_t base,
+                                   std::vector<struct hiomap_backend_op>& ops)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
+    auto& delta = ctx->delta;
+    uint64_t end = uint64_t(base) + ctx->backend.erase_size;
+    std::vector<uint32_t> indices;
+
+    /* Records are bounded in length, so none starting earlier can reach */
+    uint32_t from = base > HIOMAP_DELTA_RECORD_MAX
+                        ? base - HIOMAP_DELTA_RECORD_MAX
+                        : 0;
+    auto it = std::lower_bound(delta.order.begin(), delta.order.end(), from,
+                               [&delta](uint32_t i, uint32_t offset) {
+                                   return delta.ops[i].offset < offset;
+                               });
+
+    for (; it != delta.order.end() && delta.ops[*it].offset < end; ++it)
+    {
+        const struct hiomap_backend_op& op = delta.ops[*it];
+
+        if (uint64_t(op.offset) + op.len > base)
+        {
+            indices.push_back(*it);
+        }
+    }
 
-    if (*data_len < 4)
+    std::sort(indices.begin(), indices.end());
+    for (uint32_t i : indices)
     {
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
+        ops.push_back(delta.ops[i]);
     }
+}
 
-    uint8_t* reqdata = (uint8_t*)request;
-    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
-                                       HIOMAPD_IFACE_V2, "Erase");
-    /* FIXME: Assumes v2 */
-    m.append(le16toh(get<uint16_t>(&reqdata[0]))); /* offset */
-    m.append(le16toh(get<uint16_t>(&reqdata[2]))); /* size */
+/* Give the flash back to hiomapd and tell the host the apply is over */
+static void hiomap_delta_finish(struct hiomap* ctx, int cc)
+{
+    auto& delta = ctx->delta;
 
-    try
+    sd_event_source_set_enabled(delta.step, SD_EVENT_OFF);
+
+    /* Even a failed write may have changed the flash */
+    bool modified = delta.rewritten || cc != HIOMAP_CC_OK;
+    int resume = hiomap_flash_resume(ctx, modified);
+
+    delta.cc = cc != HIOMAP_CC_OK ? cc : resume;
+    delta.applying = false;
+    delta.done = true;
+    hiomap_delta_discard(ctx);
+
+    hiomap_set_events(ctx, ctx->bmc_events | HIOMAP_EVENT_OEM_DELTA_APPLIED);
+    hiomap_notify_events(ctx);
+}
+
+/*
+ * Apply the delta to the next erase block it touches. Steps run at idle
+ * priority like those of chunked write-back, so the host's polls are
+ * answered in between, and only one erase block is held in memory at a time.
+ */
+static int hiomap_delta_step(sd_event_source* source, void* userdata)
+{
+    struct hiomap* ctx = static_cast<struct hiomap*>(userdata);
+    auto& delta = ctx->delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    if (!delta.applying || delta.next >= delta.blocks.size())
     {
-        auto reply = ctx->bus->call(m);
+        sd_event_source_set_enabled(source, SD_EVENT_OFF);
+        return 0;
+    }
+
+    uint32_t base = delta.blocks[delta.next++];
+    uint64_t rewritten = ctx->backend.blocks_rewritten;
+    uint64_t unchanged = ctx->backend.blocks_unchanged;
+
+    hiomap_delta_block_ops(ctx, base, ops);
+    int rc = hiomap_backend_writeback_range(&ctx->backend, ops, base,
+                                            ctx->backend.erase_size);
+
+    delta.rewritten += ctx->backend.blocks_rewritten - rewritten;
+    delta.unchanged += ctx->backend.blocks_unchanged - unchanged;
+    hiomap_shadow_invalidate(&ctx->shadow, base, ctx->backend.erase_size);
 
-        *data_len = 0;
+    if (rc < 0)
+    {
+        hiomap_delta_finish(ctx, hiomap_xlate_errno(-rc));
     }
-    catch (const exception::SdBusError& e)
+    else if (delta.next == delta.blocks.size())
     {
-        return hiomap_xlate_errno(e.get_errno());
+        hiomap_delta_finish(ctx, HIOMAP_CC_OK);
     }
 
-    return IPMI_CC_OK;
+    return 0;
+}
+
+static void hiomap_delta_progress(struct hiomap* ctx, uint8_t status,
+                                  uint8_t* resp, size_t* resp_len)
+{
+    resp[0] = status;
+    put(&resp[1], htole16(static_cast<uint16_t>(
+                      std::min<uint64_t>(ctx->delta.rewritten, UINT16_MAX))));
+    put(&resp[3], htole16(static_cast<uint16_t>(
+                      std::min<uint64_t>(ctx->delta.unchanged, UINT16_MAX))));
+    *resp_len = 5;
 }
 
-#define HIOMAP_C_RESET 1
-#define HIOMAP_C_GET_INFO 2
-#define HIOMAP_C_GET_FLASH_INFO 3
-#define HIOMAP_C_CREATE_READ_WINDOW 4
-#define HIOMAP_C_CLOSE_WINDOW 5
-#define HIOMAP_C_CREATE_WRITE_WINDOW 6
-#define HIOMAP_C_MARK_DIRTY 7
-#define HIOMAP_C_FLUSH 8
-#define HIOMAP_C_ACK 9
-#define HIOMAP_C_ERASE 10
+/*
+ * Start applying the received delta in the background, erasing and
+ * programming only the erase blocks whose contents change, or report on an
+ * apply already started. See HIOMAP_DELTA_STATUS_DONE for the protocol.
+ */
+static int hiomap_oem_delta_apply(struct hiomap* ctx, const uint8_t* req,
+                                  size_t req_len, uint8_t* resp,
+                                  size_t* resp_len)
+{
+    auto& delta = ctx->delta;
+
+    if (*resp_len < 5)
+    {
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
+    }
+
+    /* The outcome is reported once; the event stays until acknowledged */
+    if (delta.done)
+    {
+        delta.done = false;
+        if (delta.cc != HIOMAP_CC_OK)
+        {
+            return delta.cc;
+        }
+
+        hiomap_delta_progress(ctx, HIOMAP_DELTA_STATUS_DONE, resp, resp_len);
+        return HIOMAP_CC_OK;
+    }
+
+    if (delta.applying)
+    {
+        hiomap_delta_progress(ctx, HIOMAP_DELTA_STATUS_RUNNING, resp,
+                              resp_len);
+        return HIOMAP_CC_OK;
+    }
+
+    if (!delta.active || delta.data.size() != delta.size)
+    {
+        return HIOMAP_CC_INVALID_FIELD_REQUEST;
+    }
+
+    /* As for OEM writes, hiomapd would drop the host's pending changes */
+    if (!ctx->dirty.empty() || (ctx->bmc_events & BMC_EVENT_FLASH_CTRL_LOST))
+    {
+        return HIOMAP_CC_BUSY;
+    }
+
+    /* A rejected delta must be sent again */
+    int cc = hiomap_delta_parse(delta.data, ctx->backend.size, delta.ops);
+    if (cc != HIOMAP_CC_OK)
+    {
+        hiomap_delta_discard(ctx);
+        return cc;
+    }
+
+    if (!hiomap_budget_charge(&delta.budget, hiomap_delta_plan(ctx)))
+    {
+        hiomap_delta_discard(ctx);
+        return HIOMAP_CC_NO_SPACE;
+    }
+
+    delta.active = false;
+    delta.rewritten = 0;
+    delta.unchanged = 0;
+    delta.next = 0;
+
+    /* Nothing to write, so no need to disturb hiomapd */
+    if (delta.blocks.empty())
+    {
+        hiomap_delta_discard(ctx);
+        hiomap_delta_progress(ctx, HIOMAP_DELTA_STATUS_DONE, resp, resp_len);
+        return HIOMAP_CC_OK;
+    }
+
+    cc = hiomap_flash_suspend(ctx);
+    if (cc != HIOMAP_CC_OK)
+    {
+        hiomap_delta_discard(ctx);
+        return cc;
+    }
+
+    delta.applying = true;
+    sd_event_source_set_enabled(delta.step, SD_EVENT_ON);
+
+    hiomap_delta_progress(ctx, HIOMAP_DELTA_STATUS_RUNNING, resp, resp_len);
+
+    return HIOMAP_CC_OK;
+}
 
 static const hiomap_command hiomap_commands[] = {
     [0] = NULL, /* Invalid command ID */
@@ -528,74 +1884,387 @@ static const hiomap_command hiomap_commands[] = {
     [HIOMAP_C_ERASE] = hiomap_erase,
 };
 
+static const hiomap_command hiomap_oem_commands[] = {
+    [HIOMAP_C_OEM_GET_EVENTS - HIOMAP_C_OEM_BASE] = hiomap_oem_get_events,
+    [HIOMAP_C_OEM_READ - HIOMAP_C_OEM_BASE] = hiomap_oem_read,
+    [HIOMAP_C_OEM_WRITE - HIOMAP_C_OEM_BASE] = hiomap_oem_write,
+    [HIOMAP_C_OEM_DELTA_START - HIOMAP_C_OEM_BASE] = hiomap_oem_delta_start,
+    [HIOMAP_C_OEM_DELTA_DATA - HIOMAP_C_OEM_BASE] = hiomap_oem_delta_data,
+    [HIOMAP_C_OEM_DELTA_APPLY - HIOMAP_C_OEM_BASE] = hiomap_oem_delta_apply,
+};
+
 /* FIXME: Define this in the "right" place, wherever that is */
 /* FIXME: Double evaluation */
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
-static ipmi_ret_t hiomap_dispatch(ipmi_netfn_t netfn, ipmi_cmd_t cmd,
-                                  ipmi_request_t request,
-                                  ipmi_response_t response,
-                                  ipmi_data_len_t data_len,
-                                  ipmi_context_t context)
+static hiomap_command hiomap_lookup_command(uint8_t cmd)
+{
+    if (cmd >= HIOMAP_C_OEM_BASE)
+    {
+        size_t idx = cmd - HIOMAP_C_OEM_BASE;
+
+        return idx < ARRAY_SIZE(hiomap_oem_commands) ? hiomap_oem_commands[idx]
+                                                      : NULL;
+    }
+
+    return cmd < ARRAY_SIZE(hiomap_commands) ? hiomap_commands[cmd] : NULL;
+}
+
+/*
+ * The host has left dirty data in its write window and gone quiet. Write it
+ * back now, so that the eventual Flush or CloseWindow finds little or nothing
+ * left to do. The window stays open and writable, as after any Flush.
+ */
+static int hiomap_idle_flush(sd_event_source* source, uint64_t usec,
+                             void* userdata)
+{
+    using namespace phosphor::logging;
+
+    struct hiomap* ctx = static_cast<struct hiomap*>(userdata);
+
+    /* A failure stays pending for the host's next command to report */
+    if (hiomap_pipeline_drain(ctx) != HIOMAP_CC_OK)
+    {
+        return 0;
+    }
+
+    if (ctx->dirty.empty() || !ctx->window.open || ctx->window.ro ||
+        (ctx->bmc_events & BMC_EVENT_FLASH_CTRL_LOST))
+    {
+        return 0;
+    }
+
+    /* hiomapd hasn't heard of the held ranges, so it can go block by block */
+    if (!ctx->writeback.held.empty())
+    {
+        sd_event_source_set_enabled(ctx->writeback.step, SD_EVENT_ON);
+        return 0;
+    }
+
+    auto m = ctx->bus->new_method_call(HIOMAPD_SERVICE, HIOMAPD_OBJECT,
+                                       HIOMAPD_IFACE_V2, "Flush");
+    uint64_t start = hiomap_now_us();
+    try
+    {
+        ctx->bus->call(m);
+
+        hiomap_writeback_record(ctx, hiomap_now_us() - start);
+        hiomap_window_flushed(ctx);
+        ctx->stats.idle_flushes++;
+    }
+    catch (const exception::SdBusError& e)
+    {
+        /* The host's own Flush will try again and see the error */
+        log<level::INFO>("Idle flush of the host write window failed",
+                         entry("ERRNO=%d", e.get_errno()));
+    }
+
+    return 0;
+}
+
+/* Push the idle flush back whenever the host does something */
+static void hiomap_idle_rearm(struct hiomap* ctx)
 {
-    struct hiomap* ctx = static_cast<struct hiomap*>(context);
+    auto settings = hiomap_settings_get(&ctx->settings);
+    uint64_t delay;
+    uint64_t now;
+
+    if (!settings->idle_flush || ctx->dirty.empty())
+    {
+        sd_event_source_set_enabled(ctx->idle_timer, SD_EVENT_OFF);
+        return;
+    }
 
-    if (*data_len < 2)
+    delay = hiomap_idle_delay(settings.get(), &ctx->command_gaps,
+                              &ctx->writeback_latency, ctx->dirty.size());
+
+    sd_event_now(ctx->event, CLOCK_MONOTONIC, &now);
+    sd_event_source_set_time(ctx->idle_timer, now + delay);
+    sd_event_source_set_enabled(ctx->idle_timer, SD_EVENT_ONESHOT);
+}
+
+static int hiomap_handle_request(struct hiomap* ctx, const uint8_t* req,
+                                 size_t req_len, uint8_t* resp,
+                                 size_t* resp_len)
+{
+    if (req_len < 2 || *resp_len < 2)
     {
-        *data_len = 0;
-        return IPMI_CC_REQ_DATA_LEN_INVALID;
+        *resp_len = 0;
+        return HIOMAP_CC_REQ_DATA_LEN_INVALID;
     }
 
-    uint8_t* ipmi_req = (uint8_t*)request;
-    uint8_t* ipmi_resp = (uint8_t*)response;
-    uint8_t hiomap_cmd = ipmi_req[0];
+    uint8_t hiomap_cmd = req[0];
+    hiomap_command handler = hiomap_lookup_command(hiomap_cmd);
 
-    if (hiomap_cmd == 0 || hiomap_cmd > ARRAY_SIZE(hiomap_commands) - 1)
+    hiomap_gaps_record(&ctx->command_gaps, hiomap_now_us());
+
+    if (!handler)
     {
-        *data_len = 0;
-        return IPMI_CC_PARM_OUT_OF_RANGE;
+        *resp_len = 0;
+        return HIOMAP_CC_PARM_OUT_OF_RANGE;
     }
 
     bool is_unversioned =
         (hiomap_cmd == HIOMAP_C_RESET || hiomap_cmd == HIOMAP_C_GET_INFO ||
-         hiomap_cmd == HIOMAP_C_ACK);
-    if (!is_unversioned && ctx->seq == ipmi_req[1])
+         hiomap_cmd == HIOMAP_C_ACK || hiomap_cmd == HIOMAP_C_OEM_GET_EVENTS);
+    if (!is_unversioned && ctx->seq == req[1])
+    {
+        hiomap_stats_record(&ctx->stats, hiomap_cmd,
+                            HIOMAP_CC_INVALID_FIELD_REQUEST, 0);
+        *resp_len = 0;
+        return HIOMAP_CC_INVALID_FIELD_REQUEST;
+    }
+
+    ctx->seq = req[1];
+
+    /* Only MarkDirty may overtake queued calls */
+    if (hiomap_cmd != HIOMAP_C_MARK_DIRTY)
+    {
+        int cc = hiomap_pipeline_drain(ctx);
+        if (cc != HIOMAP_CC_OK)
+        {
+            ctx->pipeline.error = HIOMAP_CC_OK;
+            hiomap_stats_record(&ctx->stats, hiomap_cmd, cc, 0);
+            *resp_len = 0;
+            return cc;
+        }
+    }
+
+    /* Held ranges must reach hiomapd before anything that depends on them */
+    if (!hiomap_writeback_may_overtake(hiomap_cmd))
     {
-        *data_len = 0;
-        return IPMI_CC_INVALID_FIELD_REQUEST;
+        int cc = hiomap_writeback_release(ctx);
+        if (cc != HIOMAP_CC_OK)
+        {
+            hiomap_stats_record(&ctx->stats, hiomap_cmd, cc, 0);
+            *resp_len = 0;
+            return cc;
+        }
     }
 
-    ctx->seq = ipmi_req[1];
+    const uint8_t* flash_req = req + 2;
+    size_t flash_req_len = req_len - 2;
+    uint8_t* flash_resp = resp + 2;
+    size_t flash_resp_len = *resp_len - 2;
 
-    uint8_t* flash_req = ipmi_req + 2;
-    size_t flash_len = *data_len - 2;
-    uint8_t* flash_resp = ipmi_resp + 2;
+    auto start = std::chrono::steady_clock::now();
+    int cc = handler(ctx, flash_req, flash_req_len, flash_resp,
+                     &flash_resp_len);
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
 
-    ipmi_ret_t cc =
-        hiomap_commands[hiomap_cmd](flash_req, flash_resp, &flash_len, context);
-    if (cc != IPMI_CC_OK)
+    hiomap_stats_record(&ctx->stats, hiomap_cmd, cc, us);
+
+    /* Only calls that hiomapd carried out say how long write-back takes */
+    if (cc == HIOMAP_CC_OK &&
+        (hiomap_cmd == HIOMAP_C_FLUSH || hiomap_cmd == HIOMAP_C_ERASE))
+    {
+        hiomap_writeback_record(ctx, us);
+    }
+
+    hiomap_idle_rearm(ctx);
+
+    if (cc != HIOMAP_CC_OK)
     {
-        *data_len = 0;
+        *resp_len = 0;
         return cc;
     }
 
     /* Populate the response command and sequence */
-    ipmi_resp[0] = hiomap_cmd;
-    ipmi_resp[1] = ctx->seq;
+    resp[0] = hiomap_cmd;
+    resp[1] = ctx->seq;
 
-    *data_len = flash_len + 2;
+    *resp_len = flash_resp_len + 2;
 
     return cc;
 }
-} // namespace flash
-} // namespace openpower
 
-static void register_openpower_hiomap_commands()
+int hiomap_handle(struct hiomap* ctx, const uint8_t* req, size_t req_len,
+                  uint8_t* resp, size_t* resp_len)
+{
+    using namespace phosphor::logging;
+
+    if (!hiomap_trace_active(&ctx->trace))
+    {
+        return hiomap_handle_request(ctx, req, req_len, resp, resp_len);
+    }
+
+    uint64_t arrival = hiomap_now_us();
+    int cc = hiomap_handle_request(ctx, req, req_len, resp, resp_len);
+
+    int rc = hiomap_trace_record(&ctx->trace, arrival,
+                                 hiomap_now_us() - arrival, cc, req, req_len,
+                                 resp, *resp_len);
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to write HIOMAP request trace",
+                        entry("PATH=%s", HIOMAP_TRACE_PATH),
+                        entry("ERRNO=%d", -rc));
+    }
+    else if (!hiomap_trace_active(&ctx->trace))
+    {
+        log<level::INFO>("HIOMAP request trace reached its size limit",
+                         entry("PATH=%s", HIOMAP_TRACE_PATH));
+    }
+
+    return cc;
+}
+
+/* Start or stop recording requests, as the TraceRequests setting says */
+static void hiomap_trace_update(struct hiomap* ctx)
+{
+    using namespace phosphor::logging;
+
+    if (!hiomap_settings_get(&ctx->settings)->trace_requests)
+    {
+        hiomap_trace_close(&ctx->trace);
+        return;
+    }
+
+    int rc = hiomap_trace_open(&ctx->trace, HIOMAP_TRACE_PATH,
+                               hiomap_now_us());
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to start HIOMAP request trace",
+                        entry("PATH=%s", HIOMAP_TRACE_PATH),
+                        entry("ERRNO=%d", -rc));
+    }
+}
+
+static int hiomap_export_stats(sd_event_source* source, uint64_t usec,
+                               void* userdata)
 {
-    using namespace openpower::flash;
+    using namespace phosphor::logging;
+
+    struct hiomap* ctx = static_cast<struct hiomap*>(userdata);
+
+    ctx->stats.shadow_bytes = ctx->shadow.bytes;
+    ctx->stats.shadow_shared_bytes = ctx->shadow.shared;
+    ctx->stats.shadow_hits = ctx->shadow.hits;
+    ctx->stats.shadow_misses = ctx->shadow.misses;
+    ctx->stats.pages_programmed = ctx->backend.pages_programmed;
+    ctx->stats.pages_skipped = ctx->backend.pages_skipped;
+    ctx->stats.erases = ctx->backend.erases;
+    ctx->stats.blocks_unchanged = ctx->backend.blocks_unchanged;
+    ctx->stats.verify_failures = ctx->backend.verify_failures;
+    ctx->stats.rmw_hits = ctx->backend.rmw_hits;
+    ctx->stats.rmw_misses = ctx->backend.rmw_misses;
+
+    int rc = hiomap_stats_export(&ctx->stats, HIOMAP_METRICS_PATH);
+
+    /* Only log transitions, otherwise a broken path floods the journal */
+    if (rc < 0 && rc != ctx->stats_export_err)
+    {
+        log<level::ERR>("Failed to export HIOMAP statistics",
+                        entry("PATH=%s", HIOMAP_METRICS_PATH),
+                        entry("ERRNO=%d", -rc));
+    }
+    ctx->stats_export_err = rc;
+
+    uint32_t interval = hiomap_settings_get(&ctx->settings)->metrics_interval;
+    if (interval)
+    {
+        sd_event_source_set_time(source, usec + interval * 1000000ULL);
+        sd_event_source_set_enabled(source, SD_EVENT_ONESHOT);
+    }
+
+    return 0;
+}
+
+static void hiomap_settings_changed(struct hiomap* ctx, const char* name)
+{
+    if (!strcmp(name, "VerifyWrites"))
+    {
+        ctx->backend.verify =
+            hiomap_settings_get(&ctx->settings)->verify_writes;
+    }
+
+    if (!strcmp(name, "RmwCacheBlocks"))
+    {
+        auto settings = hiomap_settings_get(&ctx->settings);
+
+        hiomap_backend_set_rmw_capacity(&ctx->backend,
+                                        settings->rmw_cache_blocks);
+    }
+
+    if (!strcmp(name, "FlashShadow") || !strcmp(name, "HostPowerAware"))
+    {
+        if (hiomap_shadow_wanted(ctx))
+        {
+            hiomap_shadow_start(&ctx->shadow);
+        }
+        else
+        {
+            hiomap_shadow_release(&ctx->shadow);
+        }
+    }
+
+    if (!strcmp(name, "SharedShadow"))
+    {
+        hiomap_shadow_release(&ctx->shadow);
+        hiomap_shadow_share(ctx);
+        if (hiomap_shadow_wanted(ctx))
+        {
+            hiomap_shadow_start(&ctx->shadow);
+        }
+    }
+
+    if (!strcmp(name, "MemoryBudget"))
+    {
+        hiomap_budget_set_limit(
+            &ctx->budget, hiomap_settings_get(&ctx->settings)->memory_budget);
+    }
+
+    if (!strcmp(name, "ChunkedWriteback") &&
+        !hiomap_settings_get(&ctx->settings)->chunked_writeback)
+    {
+        /* Report a failure on the host's next command, as for the pipeline */
+        int cc = hiomap_writeback_release(ctx);
+        if (ctx->pipeline.error == HIOMAP_CC_OK)
+        {
+            ctx->pipeline.error = cc;
+        }
+    }
+
+    if (!strcmp(name, "PipelineDepth"))
+    {
+        hiomap_pipeline_drain(ctx);
+    }
+
+    if (!strcmp(name, "IdleFlush") || !strcmp(name, "IdleFlushDelay") ||
+        !strcmp(name, "IdleFlushMin"))
+    {
+        hiomap_idle_rearm(ctx);
+    }
 
+    if (!strcmp(name, "TraceRequests"))
+    {
+        hiomap_trace_update(ctx);
+    }
+
+    if (!strcmp(name, "MetricsInterval"))
+    {
+        uint32_t interval =
+            hiomap_settings_get(&ctx->settings)->metrics_interval;
+        uint64_t now;
+
+        sd_event_now(ctx->event, CLOCK_MONOTONIC, &now);
+        sd_event_source_set_time(ctx->stats_timer, now + interval * 1000000ULL);
+        sd_event_source_set_enabled(ctx->stats_timer,
+                                    interval ? SD_EVENT_ONESHOT : SD_EVENT_OFF);
+    }
+}
+
+struct hiomap* hiomap_new(bus::bus* bus, sd_event* event, hiomap_notify notify)
+{
     /* FIXME: Clean this up? Can we unregister? */
     struct hiomap* ctx = new hiomap();
+    int rc;
+
+    ctx->bus = bus;
+    ctx->event = event;
+    ctx->notify = notify;
 
     /* Initialise mapping from signal and property names to status bit */
     ctx->event_lookup["DaemonReady"] = BMC_EVENT_DAEMON_READY;
@@ -603,8 +2272,6 @@ static void register_openpower_hiomap_commands()
     ctx->event_lookup["WindowReset"] = BMC_EVENT_WINDOW_RESET;
     ctx->event_lookup["ProtocolReset"] = BMC_EVENT_PROTOCOL_RESET;
 
-    ctx->bus = new bus::bus(ipmid_get_sd_bus_connection());
-
     /* Initialise signal handling */
 
     /*
@@ -618,6 +2285,111 @@ static void register_openpower_hiomap_commands()
     ctx->window_reset = new bus::match::match(
         std::move(hiomap_match_signal_v2(ctx, "WindowReset")));
 
-    ipmi_register_callback(NETFUN_IBM_OEM, IPMI_CMD_HIOMAP, ctx,
-                           openpower::flash::hiomap_dispatch, SYSTEM_INTERFACE);
+    /* Expose tunables for adjustment at runtime */
+    hiomap_settings_init(&ctx->settings, *ctx->bus);
+    ctx->settings.changed =
+        std::bind(hiomap_settings_changed, ctx, std::placeholders::_1);
+
+    /* All caches allocate from one budget, visible on the bus */
+    hiomap_budget_init(&ctx->budget, *ctx->bus,
+                       hiomap_settings_get(&ctx->settings)->memory_budget);
+    hiomap_budget_register(
+        &ctx->budget, &ctx->shadow.budget, "shadow", HIOMAP_BUDGET_PRIO_SHADOW,
+        std::bind(hiomap_shadow_reclaim, &ctx->shadow, std::placeholders::_1));
+    hiomap_budget_register(&ctx->budget, &ctx->backend.rmw_budget, "rmw",
+                           HIOMAP_BUDGET_PRIO_RMW,
+                           std::bind(hiomap_backend_reclaim, &ctx->backend,
+                                     std::placeholders::_1));
+    hiomap_budget_register(&ctx->budget, &ctx->delta.budget, "delta",
+                           HIOMAP_BUDGET_PRIO_DELTA, [](uint64_t bytes) {});
+
+    /* Pipelined calls need a connection of their own */
+    rc = sd_bus_open_system(&ctx->pipeline.bus);
+    if (rc < 0)
+    {
+        using namespace phosphor::logging;
+
+        log<level::INFO>("D-Bus call pipelining unavailable",
+                         entry("ERRNO=%d", -rc));
+        ctx->pipeline.bus = NULL;
+    }
+
+    /* Set up direct flash access, used for the shadow */
+    rc = hiomap_backend_open(&ctx->backend, HIOMAP_FLASH_MTD_NAME);
+    if (rc < 0)
+    {
+        using namespace phosphor::logging;
+
+        log<level::INFO>("Host flash unavailable to the HIOMAP provider",
+                         entry("MTD=%s", HIOMAP_FLASH_MTD_NAME),
+                         entry("ERRNO=%d", -rc));
+    }
+
+    hiomap_backend_set_rmw_capacity(
+        &ctx->backend, hiomap_settings_get(&ctx->settings)->rmw_cache_blocks);
+    ctx->backend.verify = hiomap_settings_get(&ctx->settings)->verify_writes;
+    hiomap_shadow_init(&ctx->shadow, &ctx->backend);
+
+    /* Share the shadow's memory with instances serving other hosts */
+    rc = hiomap_store_init(&ctx->store, HIOMAP_STORE_PATH);
+    if (rc < 0)
+    {
+        using namespace phosphor::logging;
+
+        log<level::INFO>("Shared flash shadow store unavailable",
+                         entry("PATH=%s", HIOMAP_STORE_PATH),
+                         entry("ERRNO=%d", -rc));
+        ctx->store.dirfd = -1;
+    }
+    hiomap_shadow_share(ctx);
+
+    /* Follow the host's power state */
+    if (ctx->backend.erase_size)
+    {
+        ctx->boot_seen.resize(ctx->backend.size / ctx->backend.erase_size);
+    }
+    ctx->host_off = hiomap_query_host_off(ctx);
+    ctx->host_state =
+        new bus::match::match(std::move(hiomap_match_host_state(ctx)));
+
+    if (hiomap_shadow_wanted(ctx))
+    {
+        hiomap_shadow_start(&ctx->shadow);
+    }
+
+    /* Periodically publish statistics for scraping */
+    uint32_t interval = hiomap_settings_get(&ctx->settings)->metrics_interval;
+    uint64_t now;
+
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    sd_event_add_time(event, &ctx->stats_timer, CLOCK_MONOTONIC,
+                      now + interval * 1000000ULL, 0, hiomap_export_stats, ctx);
+    sd_event_source_set_enabled(ctx->stats_timer,
+                                interval ? SD_EVENT_ONESHOT : SD_EVENT_OFF);
+
+    /* Armed by hiomap_notify_events() */
+    sd_event_add_time(event, &ctx->event_timer, CLOCK_MONOTONIC, 0, 0,
+                      hiomap_send_events, ctx);
+    sd_event_source_set_enabled(ctx->event_timer, SD_EVENT_OFF);
+
+    /* Armed by hiomap_idle_rearm() once the host leaves dirty data */
+    sd_event_add_time(event, &ctx->idle_timer, CLOCK_MONOTONIC, 0, 0,
+                      hiomap_idle_flush, ctx);
+    sd_event_source_set_enabled(ctx->idle_timer, SD_EVENT_OFF);
+
+    /* Enabled by hiomap_idle_flush() while ranges are held back */
+    sd_event_add_defer(event, &ctx->writeback.step, hiomap_writeback_step,
+                       ctx);
+    sd_event_source_set_priority(ctx->writeback.step, SD_EVENT_PRIORITY_IDLE);
+    sd_event_source_set_enabled(ctx->writeback.step, SD_EVENT_OFF);
+
+    /* Enabled by hiomap_oem_delta_apply() */
+    sd_event_add_defer(event, &ctx->delta.step, hiomap_delta_step, ctx);
+    sd_event_source_set_priority(ctx->delta.step, SD_EVENT_PRIORITY_IDLE);
+    sd_event_source_set_enabled(ctx->delta.step, SD_EVENT_OFF);
+
+    return ctx;
 }
+
+} // namespace flash
+} // namespace openpower
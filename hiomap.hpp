@@ -6,4 +6,131 @@
 
 #define IPMI_CMD_HIOMAP 0x5a
 
+#define HIOMAP_C_RESET 1
+#define HIOMAP_C_GET_INFO 2
+#define HIOMAP_C_GET_FLASH_INFO 3
+#define HIOMAP_C_CREATE_READ_WINDOW 4
+#define HIOMAP_C_CLOSE_WINDOW 5
+#define HIOMAP_C_CREATE_WRITE_WINDOW 6
+#define HIOMAP_C_MARK_DIRTY 7
+#define HIOMAP_C_FLUSH 8
+#define HIOMAP_C_ACK 9
+#define HIOMAP_C_ERASE 10
+
+/*
+ * OEM extensions live in the upper half of the command space to stay clear of
+ * future revisions of the specification.
+ */
+#define HIOMAP_C_OEM_BASE 0x80
+#define HIOMAP_C_OEM_GET_EVENTS 0x80
+#define HIOMAP_C_OEM_READ 0x81
+#define HIOMAP_C_OEM_WRITE 0x82
+#define HIOMAP_C_OEM_DELTA_START 0x83
+#define HIOMAP_C_OEM_DELTA_DATA 0x84
+#define HIOMAP_C_OEM_DELTA_APPLY 0x85
+
+/*
+ * A delta against the current flash contents, as sent with the OEM delta
+ * commands, is a series of records of the form
+ *
+ *   [op][flash offset (le32)][length (le32)][payload]
+ *
+ * where the payload is length bytes to write for HIOMAP_DELTA_DATA, or the
+ * single byte to fill the range with for HIOMAP_DELTA_FILL. Records apply in
+ * order.
+ */
+#define HIOMAP_DELTA_DATA 0x01
+#define HIOMAP_DELTA_FILL 0x02
+
+/* Largest delta the BMC will accept */
+#define HIOMAP_DELTA_MAX (4 << 20)
+
+/*
+ * Most flash a single record may cover, the largest common erase block;
+ * larger changes take several. Applying the delta an erase block at a time
+ * only has to look this far back for records reaching into a block.
+ */
+#define HIOMAP_DELTA_RECORD_MAX (64 << 10)
+
+/*
+ * A delta is applied in the background, as rewriting many erase blocks takes
+ * far longer than a host waits for a response. HIOMAP_C_OEM_DELTA_APPLY
+ * starts it and responds
+ *
+ *   [status][erase blocks rewritten (le16)][erase blocks unchanged (le16)]
+ *
+ * with the counts so far. Once the apply finishes the BMC raises
+ * HIOMAP_EVENT_OEM_DELTA_APPLIED, and the next HIOMAP_C_OEM_DELTA_APPLY
+ * reports the outcome: HIOMAP_DELTA_STATUS_DONE with the final counts, or the
+ * completion code of the failure. The host acknowledges the event as usual.
+ *
+ * hiomapd is suspended meanwhile, so the host sees FlashControlLost.
+ *
+ * The IPMI transport refuses deltas: a DELTA_DATA request carries fewer than
+ * 60 bytes through ipmid's buffers, so anything but a trivial delta would
+ * take longer to send than the image it replaces. Hosts need the socket
+ * transport for these commands.
+ */
+#define HIOMAP_DELTA_STATUS_DONE 0x00
+#define HIOMAP_DELTA_STATUS_RUNNING 0x01
+
+/* An OEM use of a BMC event bit the specification reserves */
+#define HIOMAP_EVENT_OEM_DELTA_APPLIED (1 << 2)
+
+/*
+ * Completion codes. These are IPMI's, which every transport reuses so that
+ * hosts see the same errors whichever way they reach us.
+ */
+#define HIOMAP_CC_OK 0x00
+#define HIOMAP_CC_BUSY 0xc0
+#define HIOMAP_CC_INVALID 0xc1
+#define HIOMAP_CC_TIMEOUT 0xc3
+#define HIOMAP_CC_NO_SPACE 0xc4
+#define HIOMAP_CC_REQ_DATA_LEN_INVALID 0xc7
+#define HIOMAP_CC_PARM_OUT_OF_RANGE 0xc9
+#define HIOMAP_CC_NOT_PRESENT 0xcb
+#define HIOMAP_CC_INVALID_FIELD_REQUEST 0xcc
+#define HIOMAP_CC_INSUFFICIENT_PRIVILEGE 0xd4
+#define HIOMAP_CC_UNSPECIFIED_ERROR 0xff
+
+#include <systemd/sd-event.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <sdbusplus/bus.hpp>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * The protocol core. It knows nothing of how requests reach it: a transport
+ * adapter hands it each request and passes back the response, and supplies
+ * a notify callback through which BMC event updates are sent to the host.
+ */
+struct hiomap;
+
+typedef std::function<void(struct hiomap* ctx, uint8_t events)> hiomap_notify;
+
+struct hiomap* hiomap_new(sdbusplus::bus::bus* bus, sd_event* event,
+                          hiomap_notify notify);
+
+/*
+ * Handle a request of the form [command, sequence, arguments...]. On entry
+ * *resp_len is the space available in resp; on success the response is laid
+ * out the same way as the request and *resp_len is its length.
+ *
+ * Returns a HIOMAP_CC_* completion code.
+ */
+int hiomap_handle(struct hiomap* ctx, const uint8_t* req, size_t req_len,
+                  uint8_t* resp, size_t* resp_len);
+
+/* Called by the transport when it could not deliver an event update */
+void hiomap_event_failed(struct hiomap* ctx);
+
+} // namespace flash
+} // namespace openpower
+
 #endif /* HOSTFLASH_H */
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "hiomap.hpp"
+
+#include <host-ipmid/ipmid-api.h>
+
+#include <functional>
+#include <host-ipmid/ipmid-host-cmd-utils.hpp>
+#include <host-ipmid/ipmid-host-cmd.hpp>
+#include <phosphor-logging/log.hpp>
+#include <sdbusplus/bus.hpp>
+
+/*
+ * Binds the HIOMAP protocol core to ipmid: requests arrive as IBM OEM IPMI
+ * commands and event updates go out through the host command queue.
+ */
+
+using namespace sdbusplus;
+using namespace phosphor::host::command;
+
+static void register_openpower_hiomap_commands() __attribute__((constructor));
+
+namespace openpower
+{
+namespace flash
+{
+
+constexpr auto IPMI_CMD_HIOMAP_EVENT = 0x0f;
+
+/* ipmid's request and response buffers are fixed in size */
+constexpr size_t HIOMAP_IPMI_BUFFER_MAX = 64;
+
+static void ipmi_hiomap_event_response(struct hiomap* ctx, IpmiCmdData cmd,
+                                       bool status)
+{
+    using namespace phosphor::logging;
+
+    if (!status)
+    {
+        hiomap_event_failed(ctx);
+        log<level::ERR>("Failed to deliver host command",
+                        entry("SEL_COMMAND=%x:%x", cmd.first, cmd.second));
+    }
+}
+
+static void ipmi_hiomap_notify(struct hiomap* ctx, uint8_t events)
+{
+    auto cmd = std::make_pair(IPMI_CMD_HIOMAP_EVENT, events);
+    auto cb = std::bind(ipmi_hiomap_event_response, ctx,
+                        std::placeholders::_1, std::placeholders::_2);
+
+    ipmid_send_cmd_to_host(std::make_tuple(cmd, cb));
+}
+
+static ipmi_ret_t ipmi_hiomap_dispatch(ipmi_netfn_t netfn, ipmi_cmd_t cmd,
+                                       ipmi_request_t request,
+                                       ipmi_response_t response,
+                                       ipmi_data_len_t data_len,
+                                       ipmi_context_t context)
+{
+    struct hiomap* ctx = static_cast<struct hiomap*>(context);
+    const uint8_t* req = static_cast<const uint8_t*>(request);
+    size_t resp_len = HIOMAP_IPMI_BUFFER_MAX;
+
+    /* ipmid's buffers make deltas slower than whole images, see hiomap.hpp */
+    if (*data_len >= 1 && req[0] == HIOMAP_C_OEM_DELTA_START)
+    {
+        *data_len = 0;
+        return HIOMAP_CC_INVALID;
+    }
+
+    int cc = hiomap_handle(ctx, req, *data_len, static_cast<uint8_t*>(response),
+                           &resp_len);
+
+    *data_len = resp_len;
+
+    return cc;
+}
+
+} // namespace flash
+} // namespace openpower
+
+static void register_openpower_hiomap_commands()
+{
+    using namespace openpower::flash;
+
+    bus::bus* bus = new bus::bus(ipmid_get_sd_bus_connection());
+    struct hiomap* ctx =
+        hiomap_new(bus, ipmid_get_sd_event_connection(), ipmi_hiomap_notify);
+
+    ipmi_register_callback(NETFUN_IBM_OEM, IPMI_CMD_HIOMAP, ctx,
+                           openpower::flash::ipmi_hiomap_dispatch,
+                           SYSTEM_INTERFACE);
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "policy.hpp"
+
+#include "hiomap.hpp"
+
+#include <algorithm>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Write-back samples kept before the oldest start to be aged out */
+constexpr uint64_t HIOMAP_TIMEOUT_WINDOW = 256;
+
+uint16_t hiomap_readahead_size(struct hiomap_readahead* readahead,
+                               const struct hiomap_settings* settings,
+                               uint8_t block_size_shift, uint16_t flash_size,
+                               uint16_t offset, uint16_t size)
+{
+    if (offset == readahead->next && offset)
+    {
+        readahead->sequential++;
+    }
+    else
+    {
+        readahead->sequential = 0;
+    }
+
+    /* We need the block size from GetInfo to convert the target size */
+    if (!settings->window_inflate || !block_size_shift ||
+        readahead->sequential < settings->window_inflate_after)
+    {
+        return size;
+    }
+
+    uint32_t target = settings->window_inflate_size >> block_size_shift;
+
+    if (flash_size && offset < flash_size)
+    {
+        target = std::min<uint32_t>(target, flash_size - offset);
+    }
+
+    return std::max<uint32_t>(size, std::min<uint32_t>(target, UINT16_MAX));
+}
+
+bool hiomap_writeback_may_overtake(uint8_t cmd)
+{
+    switch (cmd)
+    {
+        case HIOMAP_C_GET_INFO:
+        case HIOMAP_C_GET_FLASH_INFO:
+        case HIOMAP_C_MARK_DIRTY:
+        case HIOMAP_C_ACK:
+        case HIOMAP_C_OEM_GET_EVENTS:
+        case HIOMAP_C_OEM_READ:
+        case HIOMAP_C_OEM_DELTA_START:
+        case HIOMAP_C_OEM_DELTA_DATA:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool hiomap_writeback_should_hold(const struct hiomap_settings* settings,
+                                  bool open, bool ro, uint32_t window_size,
+                                  uint16_t offset, uint16_t size)
+{
+    return settings->chunked_writeback && open && !ro &&
+           uint32_t(offset) + size <= window_size;
+}
+
+bool hiomap_mark_dirty_pipelines(const struct hiomap_settings* settings)
+{
+    /*
+     * With write-back held, what is not held is a range hiomapd may reject,
+     * so wait for its answer rather than acknowledge it.
+     */
+    return settings->pipeline_depth && !settings->chunked_writeback;
+}
+
+void hiomap_writeback_latency_record(struct hiomap_histogram* hist,
+                                     const struct hiomap_settings* settings,
+                                     uint64_t us)
+{
+    /* Always keep enough samples to satisfy TimeoutMinSamples */
+    uint64_t window = std::max<uint64_t>(HIOMAP_TIMEOUT_WINDOW,
+                                         2ULL * settings->timeout_min_samples);
+
+    hiomap_histogram_record(hist, us);
+    if (hist->count >= window)
+    {
+        hiomap_histogram_decay(hist);
+    }
+}
+
+uint64_t hiomap_idle_delay(const struct hiomap_settings* settings,
+                           const struct hiomap_gaps* gaps,
+                           const struct hiomap_histogram* writeback_latency,
+                           size_t dirty_calls)
+{
+    uint64_t delay = settings->idle_flush_delay * 1000ULL;
+
+    /* While the window keeps being marked dirty, wait the full delay */
+    if (!settings->adaptive_coalesce || dirty_calls >= HIOMAP_IDLE_STREAM_CALLS)
+    {
+        return delay;
+    }
+
+    /*
+     * Flushing sooner than a write-back takes gains the host nothing, and
+     * risks erasing and programming blocks again that it is still part way
+     * through changing.
+     */
+    uint64_t floor = settings->idle_flush_min * 1000ULL;
+    if (writeback_latency->count)
+    {
+        floor = std::max<uint64_t>(
+            floor, hiomap_histogram_quantile(writeback_latency, 0.5));
+    }
+
+    return hiomap_gaps_idle_delay(gaps, delay, floor);
+}
+
+} // namespace flash
+} // namespace openpower
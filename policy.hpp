@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_POLICY_H
+#define HIOMAP_POLICY_H
+
+#include "coalesce.hpp"
+#include "settings.hpp"
+#include "stats.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * The provider's decisions about host requests, kept apart from the state
+ * and calls around them so that hiomap-sim replays them exactly.
+ */
+
+/* The host's progress through the flash in read windows, in blocks */
+struct hiomap_readahead
+{
+    /* Where the last read window ended */
+    uint16_t next;
+    uint32_t sequential;
+};
+
+/*
+ * The size, in blocks, to open a read window at offset with. Once the host
+ * walks forward through the flash it is given windows of the configured
+ * size, bounded by flash_size if known (non-zero). Returns size while the
+ * block size is unknown.
+ */
+uint16_t hiomap_readahead_size(struct hiomap_readahead* readahead,
+                               const struct hiomap_settings* settings,
+                               uint8_t block_size_shift, uint16_t flash_size,
+                               uint16_t offset, uint16_t size);
+
+/* Whether a command may be handled ahead of held MarkDirty ranges */
+bool hiomap_writeback_may_overtake(uint8_t cmd);
+
+/*
+ * Whether to hold a MarkDirty of the active window, of window_size blocks,
+ * for chunked write-back. Ranges hiomapd would reject are left for it to
+ * report.
+ */
+bool hiomap_writeback_should_hold(const struct hiomap_settings* settings,
+                                  bool open, bool ro, uint32_t window_size,
+                                  uint16_t offset, uint16_t size);
+
+/* Whether a MarkDirty that is not held is acknowledged ahead of hiomapd */
+bool hiomap_mark_dirty_pipelines(const struct hiomap_settings* settings);
+
+/* Note a write-back hiomapd carried out, ageing out the oldest samples */
+void hiomap_writeback_latency_record(struct hiomap_histogram* hist,
+                                     const struct hiomap_settings* settings,
+                                     uint64_t us);
+
+/*
+ * How long the host must be quiet, in microseconds, before an idle flush,
+ * given the modifying calls made since the last one
+ */
+uint64_t hiomap_idle_delay(const struct hiomap_settings* settings,
+                           const struct hiomap_gaps* gaps,
+                           const struct hiomap_histogram* writeback_latency,
+                           size_t dirty_calls);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_POLICY_H */
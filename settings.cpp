@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "settings.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <phosphor-logging/log.hpp>
+#include <string>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+struct hiomap_setting_desc
+{
+    const char* name;
+    char type; /* 'u' or 'b' */
+    uint32_t hiomap_settings::*member;
+    uint32_t min;
+    uint32_t max;
+};
+
+static const hiomap_setting_desc hiomap_setting_descs[] = {
+    {"MetricsInterval", 'u', &hiomap_settings::metrics_interval, 0, 3600},
+    {"AdaptiveTimeout", 'b', &hiomap_settings::adaptive_timeout, 0, 1},
+    {"TimeoutMin", 'u', &hiomap_settings::timeout_min, 1, UINT16_MAX},
+    {"TimeoutMax", 'u', &hiomap_settings::timeout_max, 1, UINT16_MAX},
+    {"TimeoutMargin", 'u', &hiomap_settings::timeout_margin, 1, 100},
+    {"TimeoutMinSamples", 'u', &hiomap_settings::timeout_min_samples, 0,
+     1000000},
+    {"WindowInflate", 'b', &hiomap_settings::window_inflate, 0, 1},
+    {"WindowInflateSize", 'u', &hiomap_settings::window_inflate_size, 0,
+     64 << 20},
+    {"WindowInflateAfter", 'u', &hiomap_settings::window_inflate_after, 0,
+     UINT16_MAX},
+    {"FlashShadow", 'b', &hiomap_settings::flash_shadow, 0, 1},
+    {"RmwCacheBlocks", 'u', &hiomap_settings::rmw_cache_blocks, 0, 1024},
+    {"VerifyWrites", 'b', &hiomap_settings::verify_writes, 0, 1},
+    {"IdleFlush", 'b', &hiomap_settings::idle_flush, 0, 1},
+    {"IdleFlushDelay", 'u', &hiomap_settings::idle_flush_delay, 10, 60000},
+    {"IdleFlushMin", 'u', &hiomap_settings::idle_flush_min, 1, 60000},
+    {"PipelineDepth", 'u', &hiomap_settings::pipeline_depth, 0, 64},
+    {"ChunkedWriteback", 'b', &hiomap_settings::chunked_writeback, 0, 1},
+    {"AdaptiveCoalesce", 'b', &hiomap_settings::adaptive_coalesce, 0, 1},
+    {"EventCoalesceMax", 'u', &hiomap_settings::event_coalesce_max, 0,
+     1000000},
+    {"MemoryBudget", 'u', &hiomap_settings::memory_budget, 0, 1 << 30},
+    {"HostPowerAware", 'b', &hiomap_settings::host_power_aware, 0, 1},
+    {"SharedShadow", 'b', &hiomap_settings::shared_shadow, 0, 1},
+    {"TraceRequests", 'b', &hiomap_settings::trace_requests, 0, 1},
+};
+
+static const hiomap_setting_desc* hiomap_setting_lookup(const char* name)
+{
+    for (const auto& desc : hiomap_setting_descs)
+    {
+        if (!strcmp(desc.name, name))
+        {
+            return &desc;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Constraints spanning more than one property */
+static bool hiomap_settings_valid(const struct hiomap_settings* settings)
+{
+    return settings->timeout_min <= settings->timeout_max &&
+           settings->idle_flush_min <= settings->idle_flush_delay;
+}
+
+static void hiomap_settings_publish(struct hiomap_settings_store* store,
+                                    struct hiomap_settings* settings)
+{
+    std::atomic_store(&store->current,
+                      std::shared_ptr<const struct hiomap_settings>(settings));
+}
+
+static int hiomap_settings_get_property(sd_bus* bus, const char* path,
+                                        const char* interface,
+                                        const char* property,
+                                        sd_bus_message* reply, void* userdata,
+                                        sd_bus_error* error)
+{
+    auto store = static_cast<struct hiomap_settings_store*>(userdata);
+    const hiomap_setting_desc* desc = hiomap_setting_lookup(property);
+
+    if (!desc)
+    {
+        return -ENOENT;
+    }
+
+    uint32_t value = (*hiomap_settings_get(store)).*desc->member;
+
+    if (desc->type == 'b')
+    {
+        int b = !!value;
+        return sd_bus_message_append_basic(reply, 'b', &b);
+    }
+
+    return sd_bus_message_append_basic(reply, 'u', &value);
+}
+
+static int hiomap_settings_set_property(sd_bus* bus, const char* path,
+                                        const char* interface,
+                                        const char* property,
+                                        sd_bus_message* value, void* userdata,
+                                        sd_bus_error* error)
+{
+    using namespace phosphor::logging;
+
+    auto store = static_cast<struct hiomap_settings_store*>(userdata);
+    const hiomap_setting_desc* desc = hiomap_setting_lookup(property);
+    uint32_t v;
+    int rc;
+
+    if (!desc)
+    {
+        return -ENOENT;
+    }
+
+    if (desc->type == 'b')
+    {
+        int b;
+        rc = sd_bus_message_read_basic(value, 'b', &b);
+        v = !!b;
+    }
+    else
+    {
+        rc = sd_bus_message_read_basic(value, 'u', &v);
+    }
+
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    auto settings = new hiomap_settings(*hiomap_settings_get(store));
+    settings->*desc->member = v;
+
+    if (v < desc->min || v > desc->max || !hiomap_settings_valid(settings))
+    {
+        delete settings;
+        return sd_bus_error_set(error, SD_BUS_ERROR_INVALID_ARGS,
+                                "Value out of range");
+    }
+
+    hiomap_settings_publish(store, settings);
+
+    log<level::INFO>("Updated HIOMAP provider setting",
+                     entry("SETTING=%s", property), entry("VALUE=%u", v));
+
+    store->iface->property_changed(property);
+
+    if (store->changed)
+    {
+        store->changed(property);
+    }
+
+    return 1;
+}
+
+int hiomap_settings_assign(struct hiomap_settings* settings,
+                           const char* assignment)
+{
+    const char* eq = strchr(assignment, '=');
+    char* end;
+
+    if (!eq)
+    {
+        return -EINVAL;
+    }
+
+    std::string name(assignment, eq - assignment);
+    const hiomap_setting_desc* desc = hiomap_setting_lookup(name.c_str());
+    if (!desc)
+    {
+        return -ENOENT;
+    }
+
+    errno = 0;
+    unsigned long v = strtoul(eq + 1, &end, 0);
+    if (errno || end == eq + 1 || *end || v < desc->min || v > desc->max)
+    {
+        return -ERANGE;
+    }
+
+    struct hiomap_settings updated = *settings;
+    updated.*desc->member = v;
+    if (!hiomap_settings_valid(&updated))
+    {
+        return -ERANGE;
+    }
+
+    *settings = updated;
+
+    return 0;
+}
+
+/* Return every setting to its value at startup */
+static int hiomap_settings_restore(sd_bus_message* msg, void* userdata,
+                                   sd_bus_error* error)
+{
+    using namespace phosphor::logging;
+
+    auto store = static_cast<struct hiomap_settings_store*>(userdata);
+    auto previous = hiomap_settings_get(store);
+    const struct hiomap_settings* initial = store->initial.get();
+    std::vector<const char*> changed;
+
+    /* Only act on what actually changes, as for a property update */
+    for (const auto& desc : hiomap_setting_descs)
+    {
+        if ((*previous).*desc.member != initial->*desc.member)
+        {
+            changed.push_back(desc.name);
+        }
+    }
+
+    hiomap_settings_publish(store, new hiomap_settings(*initial));
+
+    log<level::INFO>("Restored HIOMAP provider settings",
+                     entry("CHANGED=%zu", changed.size()));
+
+    for (const char* name : changed)
+    {
+        store->iface->property_changed(name);
+
+        if (store->changed)
+        {
+            store->changed(name);
+        }
+    }
+
+    return sd_bus_reply_method_return(msg, "");
+}
+
+void hiomap_settings_init(struct hiomap_settings_store* store,
+                          sdbusplus::bus::bus& bus)
+{
+    using namespace sdbusplus;
+
+    store->initial = std::make_shared<const hiomap_settings>();
+    hiomap_settings_publish(store, new hiomap_settings(*store->initial));
+
+    store->vtable.push_back(vtable::start());
+    store->vtable.push_back(
+        vtable::method("Restore", "", "", hiomap_settings_restore));
+    for (const auto& desc : hiomap_setting_descs)
+    {
+        store->vtable.push_back(vtable::property(
+            desc.name, desc.type == 'b' ? "b" : "u",
+            hiomap_settings_get_property, hiomap_settings_set_property,
+            vtable::property_::emits_change));
+    }
+    store->vtable.push_back(vtable::end());
+
+    store->iface = std::make_unique<server::interface::interface>(
+        bus, HIOMAP_SETTINGS_OBJECT, HIOMAP_SETTINGS_IFACE,
+        store->vtable.data(), store);
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_SETTINGS_H
+#define HIOMAP_SETTINGS_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+constexpr auto HIOMAP_SETTINGS_OBJECT = "/org/open_power/hiomap";
+constexpr auto HIOMAP_SETTINGS_IFACE = "org.open_power.Hiomap.Settings";
+
+/*
+ * Provider tunables. Instances are immutable once published: an update
+ * copies the current snapshot, modifies the copy and swaps it in.
+ */
+struct hiomap_settings
+{
+    /* Seconds between statistics exports, 0 to disable */
+    uint32_t metrics_interval = HIOMAP_METRICS_INTERVAL;
+
+    /* Derive the GetInfo timeout from observed write-back latency */
+    uint32_t adaptive_timeout = 1;
+    /* Bounds on the timeout suggested to the host, in seconds */
+    uint32_t timeout_min = 2;
+    uint32_t timeout_max = 60;
+    /* Headroom applied to the observed p99 write-back latency */
+    uint32_t timeout_margin = 4;
+    /* Flush and Erase samples required before we trust the estimate */
+    uint32_t timeout_min_samples = 32;
+
+    /* Hand sequential readers larger windows than they ask for */
+    uint32_t window_inflate = 1;
+    /* Size of inflated windows, in bytes */
+    uint32_t window_inflate_size = 1 << 20;
+    /* Consecutive sequential read windows before inflating */
+    uint32_t window_inflate_after = 2;
+
+    /* Keep a compressed copy of the host flash in RAM */
+    uint32_t flash_shadow = 0;
+
+    /* Erase blocks kept to avoid read-back on partial block writes */
+    uint32_t rmw_cache_blocks = 16;
+
+    /* Read back and compare flash after the provider writes it */
+    uint32_t verify_writes = 0;
+
+    /* Flush dirty windows once the host has been quiet for a while */
+    uint32_t idle_flush = 1;
+    /* Milliseconds without a host command before flushing */
+    uint32_t idle_flush_delay = 200;
+    /* Fewest milliseconds adaptive coalescing may cut the delay to */
+    uint32_t idle_flush_min = 20;
+
+    /*
+     * MarkDirty calls queued before they are sent to hiomapd together, 0 to
+     * call hiomapd for each. Failures are then reported on a later command.
+     */
+    uint32_t pipeline_depth = 0;
+
+    /*
+     * Hold MarkDirty calls back from hiomapd so idle write-back can be done
+     * an erase block at a time, serving the host in between
+     */
+    uint32_t chunked_writeback = 1;
+
+    /* Shorten the idle flush delay from the gaps between host commands */
+    uint32_t adaptive_coalesce = 1;
+    /* Wait, in microseconds, to merge BMC event updates */
+    uint32_t event_coalesce_max = 2000;
+
+    /* Bytes all caches together may use, 0 for no limit */
+    uint32_t memory_budget = 32 << 20;
+
+    /* Drop caches while the host is off and warm them as it powers on */
+    uint32_t host_power_aware = 1;
+
+    /* Share identical shadow blocks with the other hosts' instances */
+    uint32_t shared_shadow = 1;
+
+    /* Record host requests to HIOMAP_TRACE_PATH for hiomap-sim */
+    uint32_t trace_requests = 0;
+};
+
+struct hiomap_settings_store
+{
+    /*
+     * Swapped with std::atomic_load and std::atomic_store, so a reader keeps
+     * its snapshot alive however many updates race it
+     */
+    std::shared_ptr<const struct hiomap_settings> current;
+
+    /* The settings the provider started with, for the Restore method */
+    std::shared_ptr<const struct hiomap_settings> initial;
+
+    std::vector<sdbusplus::vtable::vtable_t> vtable;
+    std::unique_ptr<sdbusplus::server::interface::interface> iface;
+
+    /* Invoked with the property name after a successful update */
+    std::function<void(const char*)> changed;
+};
+
+static inline std::shared_ptr<const struct hiomap_settings>
+    hiomap_settings_get(const struct hiomap_settings_store* store)
+{
+    return std::atomic_load(&store->current);
+}
+
+/*
+ * Apply a NAME=VALUE assignment, named as on the bus, to settings. For tools
+ * that model the provider offline. Returns 0 on success or a negative errno.
+ */
+int hiomap_settings_assign(struct hiomap_settings* settings,
+                           const char* assignment);
+
+/* Publish the defaults and expose them, and a Restore method, on the bus */
+void hiomap_settings_init(struct hiomap_settings_store* store,
+                          sdbusplus::bus::bus& bus);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_SETTINGS_H */
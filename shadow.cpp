@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "shadow.hpp"
+
+#include <lz4.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <phosphor-logging/log.hpp>
+
+namespace openpower
+{
+namespace flash
+{
+
+void hiomap_shadow_init(struct hiomap_shadow* shadow,
+                        struct hiomap_backend* backend)
+{
+    shadow->backend = backend;
+
+    if (hiomap_backend_ready(backend))
+    {
+        shadow->blocks.resize(backend->size / backend->erase_size);
+    }
+}
+
+static void hiomap_shadow_drop(struct hiomap_shadow* shadow,
+                               struct hiomap_shadow_block* block)
+{
+    shadow->bytes -= block->len;
+    hiomap_budget_release(&shadow->budget, block->len);
+
+    if (block->shared.data)
+    {
+        if (!block->shared.created)
+        {
+            shadow->shared -= block->len;
+        }
+
+        hiomap_store_put(shadow->store, &block->shared);
+    }
+
+    block->priv.reset();
+    block->data = nullptr;
+    block->len = 0;
+    block->generation++;
+}
+
+static void hiomap_shadow_load(struct hiomap_shadow* shadow)
+{
+    using namespace phosphor::logging;
+
+    uint32_t erase_size = shadow->backend->erase_size;
+    int bound = LZ4_compressBound(erase_size);
+    std::vector<char> raw(erase_size);
+    std::vector<char> compressed(bound);
+    std::vector<size_t> order;
+
+    {
+        std::lock_guard<std::mutex> guard(shadow->lock);
+        order = shadow->first;
+    }
+
+    /* Blocks already loaded from the priority list are skipped below */
+    for (size_t i = 0; i < shadow->blocks.size(); i++)
+    {
+        order.push_back(i);
+    }
+
+    for (size_t i : order)
+    {
+        uint32_t generation;
+
+        if (shadow->stop)
+        {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(shadow->lock);
+
+            if (shadow->blocks[i].len)
+            {
+                continue;
+            }
+
+            generation = shadow->blocks[i].generation;
+        }
+
+        int rc = hiomap_backend_read(shadow->backend, i * erase_size,
+                                     raw.data(), erase_size);
+        if (rc < 0)
+        {
+            log<level::ERR>("Failed to load flash shadow block",
+                            entry("OFFSET=0x%x", i * erase_size),
+                            entry("ERRNO=%d", -rc));
+            break;
+        }
+
+        int len = LZ4_compress_default(raw.data(), compressed.data(),
+                                       erase_size, bound);
+        bool store_raw = len <= 0 || static_cast<uint32_t>(len) >= erase_size;
+        const char* src = store_raw ? raw.data() : compressed.data();
+
+        if (store_raw)
+        {
+            len = erase_size;
+        }
+
+        struct hiomap_store_object obj;
+        std::unique_ptr<char[]> data;
+
+        /*
+         * Blocks another host's instance published are charged too: once it
+         * drops them, the pages are held by us alone
+         */
+        if (!hiomap_budget_charge(&shadow->budget, len))
+        {
+            /* Everything else matters more than the shadow, so stop here */
+            log<level::INFO>("Flash shadow stopped at the memory budget",
+                             entry("BLOCK=%zu", i));
+            break;
+        }
+
+        if (!shadow->store ||
+            hiomap_store_get(shadow->store, src, len, true, &obj))
+        {
+            data.reset(new char[len]);
+            std::memcpy(data.get(), src, len);
+        }
+
+        std::lock_guard<std::mutex> guard(shadow->lock);
+        struct hiomap_shadow_block* block = &shadow->blocks[i];
+
+        /* The host may have written to the block while we read it */
+        if (block->generation != generation || block->len)
+        {
+            hiomap_budget_release(&shadow->budget, len);
+            hiomap_store_put(shadow->store, &obj);
+            continue;
+        }
+
+        block->priv = std::move(data);
+        block->shared = obj;
+        block->data = obj.data ? obj.data : block->priv.get();
+        block->len = len;
+        block->raw = store_raw;
+        shadow->bytes += len;
+        if (obj.data && !obj.created)
+        {
+            shadow->shared += len;
+        }
+    }
+}
+
+void hiomap_shadow_start(struct hiomap_shadow* shadow)
+{
+    if (shadow->blocks.empty())
+    {
+        return;
+    }
+
+    /* A previous pass may still be running; let it finish and go again */
+    shadow->stop = true;
+    if (shadow->loader.joinable())
+    {
+        shadow->loader.join();
+    }
+
+    shadow->stop = false;
+    shadow->loader = std::thread(hiomap_shadow_load, shadow);
+}
+
+void hiomap_shadow_prioritise(struct hiomap_shadow* shadow,
+                              std::vector<size_t> blocks)
+{
+    std::lock_guard<std::mutex> guard(shadow->lock);
+
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                                [shadow](size_t i) {
+                                    return i >= shadow->blocks.size();
+                                }),
+                 blocks.end());
+    shadow->first = std::move(blocks);
+}
+
+void hiomap_shadow_release(struct hiomap_shadow* shadow)
+{
+    shadow->stop = true;
+    if (shadow->loader.joinable())
+    {
+        shadow->loader.join();
+    }
+
+    std::lock_guard<std::mutex> guard(shadow->lock);
+    for (auto& block : shadow->blocks)
+    {
+        hiomap_shadow_drop(shadow, &block);
+    }
+}
+
+void hiomap_shadow_reclaim(struct hiomap_shadow* shadow, uint64_t bytes)
+{
+    std::lock_guard<std::mutex> guard(shadow->lock);
+    uint64_t freed = 0;
+
+    for (auto it = shadow->blocks.rbegin();
+         it != shadow->blocks.rend() && freed < bytes; ++it)
+    {
+        if (it->len)
+        {
+            freed += it->len;
+            hiomap_shadow_drop(shadow, &*it);
+        }
+    }
+}
+
+void hiomap_shadow_invalidate(struct hiomap_shadow* shadow, uint32_t offset,
+                              uint32_t len)
+{
+    if (shadow->blocks.empty() || !len)
+    {
+        return;
+    }
+
+    uint32_t erase_size = shadow->backend->erase_size;
+    size_t first = offset / erase_size;
+    size_t last = std::min<size_t>((uint64_t(offset) + len - 1) / erase_size,
+                                   shadow->blocks.size() - 1);
+
+    std::lock_guard<std::mutex> guard(shadow->lock);
+    for (size_t i = first; i <= last; i++)
+    {
+        hiomap_shadow_drop(shadow, &shadow->blocks[i]);
+    }
+}
+
+/* Copy the requested part of block i out of the shadow, if present */
+static bool hiomap_shadow_copy(struct hiomap_shadow* shadow, size_t i,
+                               uint32_t start, uint8_t* buf, size_t len,
+                               std::vector<char>& scratch)
+{
+    std::lock_guard<std::mutex> guard(shadow->lock);
+    struct hiomap_shadow_block* block = &shadow->blocks[i];
+
+    if (!block->len)
+    {
+        return false;
+    }
+
+    if (block->raw)
+    {
+        std::memcpy(buf, block->data + start, len);
+        return true;
+    }
+
+    int rc = LZ4_decompress_safe(block->data, scratch.data(),
+                                 block->len, scratch.size());
+    if (rc != static_cast<int>(scratch.size()))
+    {
+        /* Corrupt? Drop it and let the caller fall back to flash */
+        hiomap_shadow_drop(shadow, block);
+        return false;
+    }
+
+    std::memcpy(buf, scratch.data() + start, len);
+
+    return true;
+}
+
+int hiomap_shadow_read(struct hiomap_shadow* shadow, uint32_t offset,
+                       void* buf, size_t len)
+{
+    struct hiomap_backend* backend = shadow->backend;
+    uint8_t* cursor = static_cast<uint8_t*>(buf);
+
+    if (!hiomap_backend_ready(backend))
+    {
+        return -ENODEV;
+    }
+
+    if (offset > backend->size || len > backend->size - offset)
+    {
+        return -EINVAL;
+    }
+
+    if (shadow->blocks.empty())
+    {
+        return hiomap_backend_read(backend, offset, buf, len);
+    }
+
+    std::vector<char> scratch(backend->erase_size);
+
+    while (len)
+    {
+        size_t i = offset / backend->erase_size;
+        uint32_t start = offset % backend->erase_size;
+        size_t chunk = std::min<size_t>(len, backend->erase_size - start);
+
+        if (hiomap_shadow_copy(shadow, i, start, cursor, chunk, scratch))
+        {
+            shadow->hits++;
+        }
+        else
+        {
+            shadow->misses++;
+
+            int rc = hiomap_backend_read(backend, offset, cursor, chunk);
+            if (rc < 0)
+            {
+                return rc;
+            }
+        }
+
+        cursor += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+} // namespace flash
+} // namespace openpower
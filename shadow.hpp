@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_SHADOW_H
+#define HIOMAP_SHADOW_H
+
+#include "backend.hpp"
+#include "budget.hpp"
+#include "store.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * A RAM copy of the host flash, LZ4-compressed per erase block. Blocks are
+ * loaded by a background thread; reads of blocks that are not (yet) present
+ * fall through to the backend. It serves HIOMAP_C_OEM_READ; hiomapd still
+ * loads the host's windows from flash itself.
+ *
+ * Given a store, blocks are shared with other instances holding the same
+ * contents. Shared blocks are never modified: a write by the host drops this
+ * instance's reference and the block is reloaded into a new object.
+ */
+struct hiomap_shadow_block
+{
+    /* Either priv or the shared object */
+    const char* data;
+    std::unique_ptr<char[]> priv;
+    struct hiomap_store_object shared;
+    /* Length of data, 0 if the block is not present. Charged to the budget. */
+    uint32_t len;
+    /* Stored uncompressed when LZ4 cannot shrink the block */
+    bool raw;
+    /* Bumped on invalidation so the loader can discard stale reads */
+    uint32_t generation;
+};
+
+struct hiomap_shadow
+{
+    struct hiomap_backend* backend;
+    /* Where to share blocks, or NULL. Only changed while released. */
+    struct hiomap_store* store;
+
+    /* Protects blocks */
+    std::mutex lock;
+    std::vector<struct hiomap_shadow_block> blocks;
+    /* Blocks to load ahead of the rest, in order */
+    std::vector<size_t> first;
+
+    std::thread loader;
+    std::atomic<bool> stop;
+
+    /* Compressed bytes held, and how many of those another instance owns */
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> shared;
+    struct hiomap_budget_client budget;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+
+void hiomap_shadow_init(struct hiomap_shadow* shadow,
+                        struct hiomap_backend* backend);
+
+/* Start loading absent blocks in the background */
+void hiomap_shadow_start(struct hiomap_shadow* shadow);
+
+/* Have subsequent loads fetch the given blocks before any others */
+void hiomap_shadow_prioritise(struct hiomap_shadow* shadow,
+                              std::vector<size_t> blocks);
+
+/* Stop the loader and drop all blocks */
+void hiomap_shadow_release(struct hiomap_shadow* shadow);
+
+/* Drop blocks from the end of flash back until bytes have been freed */
+void hiomap_shadow_reclaim(struct hiomap_shadow* shadow, uint64_t bytes);
+
+/* Discard blocks overlapping the range, e.g. because the host wrote to it */
+void hiomap_shadow_invalidate(struct hiomap_shadow* shadow, uint32_t offset,
+                              uint32_t len);
+
+/* Returns 0 on success or a negative errno */
+int hiomap_shadow_read(struct hiomap_shadow* shadow, uint32_t offset,
+                       void* buf, size_t len);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_SHADOW_H */
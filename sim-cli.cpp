@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "sim.hpp"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * hiomap-sim: replays a request trace recorded by the provider against a
+ * latency model, predicting what the host would see under other settings,
+ * or searching for the settings that would serve it best.
+ */
+
+using namespace openpower::flash;
+
+constexpr uint32_t HIOMAP_SIM_MEMORY_CAP = 32 << 20;
+constexpr uint32_t HIOMAP_SIM_TOP = 5;
+
+/* What --tune tries unless told otherwise */
+static const std::vector<struct hiomap_sim_sweep> hiomap_sim_default_sweeps = {
+    {"WindowInflateSize", {256 << 10, 1 << 20, 4 << 20}},
+    {"WindowInflateAfter", {1, 2, 4}},
+    {"IdleFlushDelay", {50, 200, 1000}},
+    {"AdaptiveCoalesce", {0, 1}},
+    {"PipelineDepth", {0, 4, 16}},
+    {"ChunkedWriteback", {0, 1}},
+    {"FlashShadow", {0, 1}},
+    {"MemoryBudget", {8 << 20, 32 << 20, 128 << 20}},
+};
+
+static void hiomap_sim_usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]... TRACE\n"
+            "\n"
+            "Replay TRACE, recorded with the TraceRequests setting, and\n"
+            "report the latency the host would see and the flash work done.\n"
+            "\n"
+            "  -s, --set NAME=VALUE      Provider setting, named as on D-Bus\n"
+            "  -t, --tune                Search for the settings giving the\n"
+            "                            lowest p99 latency instead\n"
+            "  -v, --vary NAME=V1,V2...  Values to try for a setting when\n"
+            "                            tuning, replacing any defaults\n"
+            "  -c, --memory-cap BYTES    Most memory the caches may use when\n"
+            "                            tuning (default %u)\n"
+            "  -n, --top N               Settings to list when tuning\n"
+            "                            (default %u)\n"
+            "  -m, --model NAME=VALUE    Latency model parameter, one of:\n"
+            "      transport             Per command host transport (us)\n"
+            "      dbus                  hiomapd call round trip (us)\n"
+            "      provider              Provider handling per command (us)\n"
+            "      read                  Flash read (us/KiB)\n"
+            "      program               Flash program (us/KiB)\n"
+            "      erase                 Flash erase (us/erase block)\n"
+            "      shadow-read           Shadow read (us/KiB)\n"
+            "      shadow-ratio          Shadow size as a percentage of the\n"
+            "                            flash it holds\n"
+            "      window-cache          Windows hiomapd keeps loaded\n"
+            "      block-size            Until the trace's GetInfo\n"
+            "      erase-size            Until the trace's GetFlashInfo\n"
+            "      flash-size            Until the trace's GetFlashInfo\n",
+            name, HIOMAP_SIM_MEMORY_CAP, HIOMAP_SIM_TOP);
+}
+
+static void hiomap_sim_report(const struct hiomap_sim_result* result)
+{
+    printf("%-18s %8s %6s %12s %12s %10s %10s\n", "command", "count",
+           "errors", "recorded (us)", "mean (us)", "p50 (us)", "p99 (us)");
+
+    for (size_t cmd = 0; cmd < result->predicted.size(); cmd++)
+    {
+        const struct hiomap_command_stats* cs = &result->predicted[cmd];
+        const struct hiomap_histogram* rec = &result->recorded[cmd];
+        const char* name = hiomap_command_name(cmd);
+
+        if (!name || !cs->latency.count)
+        {
+            continue;
+        }
+
+        printf("%-18s %8llu %6llu %12llu %12llu %10llu %10llu\n", name,
+               (unsigned long long)cs->latency.count,
+               (unsigned long long)cs->errors,
+               (unsigned long long)(rec->sum_us / rec->count),
+               (unsigned long long)(cs->latency.sum_us / cs->latency.count),
+               (unsigned long long)hiomap_histogram_quantile(&cs->latency,
+                                                             0.5),
+               (unsigned long long)hiomap_histogram_quantile(&cs->latency,
+                                                             0.99));
+    }
+
+    printf("\nelapsed: %.3fs recorded, %.3fs predicted\n",
+           result->recorded_us / 1e6, result->predicted_us / 1e6);
+    printf("hiomapd calls: %llu\n", (unsigned long long)result->dbus_calls);
+    printf("flash read: %.2f MiB\n", result->flash_read_bytes / 1048576.0);
+    printf("flash programmed: %.2f MiB\n",
+           result->flash_program_bytes / 1048576.0);
+    printf("erase blocks erased: %llu\n",
+           (unsigned long long)result->flash_erases);
+    printf("windows reused: %llu of %llu\n",
+           (unsigned long long)result->window_hits,
+           (unsigned long long)(result->window_hits + result->window_misses));
+    printf("shadow hits: %llu of %llu\n",
+           (unsigned long long)result->shadow_hits,
+           (unsigned long long)(result->shadow_hits + result->shadow_misses));
+    printf("idle flushes: %llu\n", (unsigned long long)result->idle_flushes);
+    printf("cache memory: %.2f MiB\n", result->memory_bytes / 1048576.0);
+}
+
+/* Parse NAME=V1,V2,... into sweeps, replacing any sweep of NAME */
+static int hiomap_sim_vary(std::vector<struct hiomap_sim_sweep>& sweeps,
+                           const char* arg)
+{
+    const char* eq = strchr(arg, '=');
+    struct hiomap_sim_sweep sweep;
+
+    if (!eq || eq == arg)
+    {
+        return -EINVAL;
+    }
+
+    sweep.name.assign(arg, eq - arg);
+
+    const char* pos = eq + 1;
+    for (;;)
+    {
+        char* end;
+
+        errno = 0;
+        unsigned long v = strtoul(pos, &end, 0);
+        if (errno || end == pos || v > UINT32_MAX || (*end && *end != ','))
+        {
+            return -EINVAL;
+        }
+
+        /* Catch an unknown setting or a value out of range here */
+        struct hiomap_settings settings;
+        std::string assignment = sweep.name + "=" + std::to_string(v);
+        int rc = hiomap_settings_assign(&settings, assignment.c_str());
+        if (rc < 0)
+        {
+            return rc;
+        }
+
+        sweep.values.push_back(v);
+
+        if (!*end)
+        {
+            break;
+        }
+
+        pos = end + 1;
+    }
+
+    auto it = std::find_if(sweeps.begin(), sweeps.end(),
+                           [&sweep](const struct hiomap_sim_sweep& s) {
+                               return s.name == sweep.name;
+                           });
+    if (it != sweeps.end())
+    {
+        *it = std::move(sweep);
+    }
+    else
+    {
+        sweeps.push_back(std::move(sweep));
+    }
+
+    return 0;
+}
+
+static int hiomap_sim_tune_report(
+    const std::vector<struct hiomap_trace_entry>& trace,
+    const struct hiomap_sim_model* model,
+    const struct hiomap_settings* settings,
+    const std::vector<struct hiomap_sim_sweep>& sweeps, uint64_t memory_cap,
+    size_t top)
+{
+    std::vector<struct hiomap_sim_candidate> ranked;
+    size_t combinations = 1;
+
+    int rc = hiomap_sim_tune(trace, model, settings, sweeps, memory_cap,
+                             ranked);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Bad sweep: %s\n", strerror(-rc));
+        return rc;
+    }
+
+    for (const auto& sweep : sweeps)
+    {
+        combinations *= sweep.values.size();
+    }
+
+    printf("%zu of %zu combinations within %.1f MiB\n", ranked.size(),
+           combinations, memory_cap / 1048576.0);
+
+    if (ranked.empty())
+    {
+        return -ENOSPC;
+    }
+
+    printf("\n%4s %10s %10s %12s  %s\n", "rank", "p99 (us)", "mean (us)",
+           "memory (MiB)", "settings");
+    for (size_t i = 0; i < std::min(top, ranked.size()); i++)
+    {
+        const struct hiomap_sim_candidate* c = &ranked[i];
+        std::string assignments;
+
+        for (const auto& assignment : c->assignments)
+        {
+            assignments += " " + assignment;
+        }
+
+        printf("%4zu %10llu %10llu %12.1f %s\n", i + 1,
+               (unsigned long long)c->p99_us, (unsigned long long)c->mean_us,
+               c->memory_bytes / 1048576.0, assignments.c_str());
+    }
+
+    printf("\nRecommended, on %s %s:\n", HIOMAP_SETTINGS_OBJECT,
+           HIOMAP_SETTINGS_IFACE);
+    for (const auto& assignment : ranked.front().assignments)
+    {
+        printf("  %s\n", assignment.c_str());
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        {"set", required_argument, NULL, 's'},
+        {"model", required_argument, NULL, 'm'},
+        {"tune", no_argument, NULL, 't'},
+        {"vary", required_argument, NULL, 'v'},
+        {"memory-cap", required_argument, NULL, 'c'},
+        {"top", required_argument, NULL, 'n'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    std::vector<struct hiomap_trace_entry> trace;
+    struct hiomap_settings settings;
+    struct hiomap_sim_model model;
+    struct hiomap_sim_result* result;
+    std::vector<struct hiomap_sim_sweep> sweeps = hiomap_sim_default_sweeps;
+    uint64_t memory_cap = HIOMAP_SIM_MEMORY_CAP;
+    size_t top = HIOMAP_SIM_TOP;
+    bool tune = false;
+    int rc;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:m:tv:c:n:h", long_options,
+                            NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                rc = hiomap_settings_assign(&settings, optarg);
+                if (rc < 0)
+                {
+                    fprintf(stderr, "Bad setting '%s': %s\n", optarg,
+                            strerror(-rc));
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                rc = hiomap_sim_model_assign(&model, optarg);
+                if (rc < 0)
+                {
+                    fprintf(stderr, "Bad model parameter '%s': %s\n", optarg,
+                            strerror(-rc));
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                tune = true;
+                break;
+            case 'v':
+                rc = hiomap_sim_vary(sweeps, optarg);
+                if (rc < 0)
+                {
+                    fprintf(stderr, "Bad sweep '%s': %s\n", optarg,
+                            strerror(-rc));
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                memory_cap = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                top = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                hiomap_sim_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                hiomap_sim_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        hiomap_sim_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    rc = hiomap_trace_load(argv[optind], trace);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Failed to load %s: %s\n", argv[optind],
+                strerror(-rc));
+        return EXIT_FAILURE;
+    }
+
+    if (tune)
+    {
+        rc = hiomap_sim_tune_report(trace, &model, &settings, sweeps,
+                                    memory_cap, top);
+        return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    /* Too large for the stack */
+    result = new hiomap_sim_result;
+    hiomap_sim_run(trace, &model, &settings, result);
+    hiomap_sim_report(result);
+    delete result;
+
+    return EXIT_SUCCESS;
+}
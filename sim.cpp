@@ -0,0 +1,812 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "sim.hpp"
+
+#include "coalesce.hpp"
+#include "hiomap.hpp"
+#include "policy.hpp"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace openpower
+{
+namespace flash
+{
+
+struct hiomap_sim_model_desc
+{
+    const char* name;
+    uint32_t hiomap_sim_model::*member;
+};
+
+static const hiomap_sim_model_desc hiomap_sim_model_descs[] = {
+    {"transport", &hiomap_sim_model::transport_us},
+    {"dbus", &hiomap_sim_model::dbus_us},
+    {"provider", &hiomap_sim_model::provider_us},
+    {"read", &hiomap_sim_model::read_us_per_kib},
+    {"program", &hiomap_sim_model::program_us_per_kib},
+    {"erase", &hiomap_sim_model::erase_us},
+    {"shadow-read", &hiomap_sim_model::shadow_us_per_kib},
+    {"shadow-ratio", &hiomap_sim_model::shadow_ratio},
+    {"window-cache", &hiomap_sim_model::window_cache},
+    {"block-size", &hiomap_sim_model::block_size},
+    {"erase-size", &hiomap_sim_model::erase_size},
+    {"flash-size", &hiomap_sim_model::flash_size},
+};
+
+int hiomap_sim_model_assign(struct hiomap_sim_model* model,
+                            const char* assignment)
+{
+    const char* eq = strchr(assignment, '=');
+    char* end;
+
+    if (!eq)
+    {
+        return -EINVAL;
+    }
+
+    std::string name(assignment, eq - assignment);
+    for (const auto& desc : hiomap_sim_model_descs)
+    {
+        if (name != desc.name)
+        {
+            continue;
+        }
+
+        errno = 0;
+        unsigned long v = strtoul(eq + 1, &end, 0);
+        if (errno || end == eq + 1 || *end || v > UINT32_MAX)
+        {
+            return -ERANGE;
+        }
+
+        if (desc.member == &hiomap_sim_model::shadow_ratio &&
+            (!v || v > 100))
+        {
+            return -ERANGE;
+        }
+
+        /* Geometry is in blocks on the wire, so must be a power of two */
+        bool geometry = desc.member == &hiomap_sim_model::block_size ||
+                        desc.member == &hiomap_sim_model::erase_size;
+        if (geometry && (!v || (v & (v - 1))))
+        {
+            return -ERANGE;
+        }
+
+        model->*desc.member = v;
+
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+/* The provider as a single server in front of hiomapd and the flash */
+struct hiomap_sim
+{
+    const struct hiomap_sim_model* model;
+    const struct hiomap_settings* settings;
+    struct hiomap_sim_result* result;
+
+    uint8_t block_size_shift;
+    uint32_t erase_size;
+    uint32_t flash_size;
+
+    /* When the provider is next free, whatever it is doing */
+    uint64_t busy_until;
+
+    /* The active window, in bytes */
+    struct
+    {
+        bool open;
+        bool ro;
+        uint32_t offset;
+        uint32_t size;
+    } window;
+
+    /* Byte ranges hiomapd has loaded, most recently used first */
+    std::list<std::pair<uint32_t, uint32_t>> loaded;
+
+    struct hiomap_readahead readahead;
+
+    /* Erase blocks modified since the last flush, and the calls doing so */
+    std::set<uint32_t> dirty;
+    uint32_t dirty_calls;
+    /* Those held back from hiomapd, and the MarkDirty calls holding them */
+    std::set<uint32_t> held;
+    uint32_t held_calls;
+    bool writing_back;
+
+    /* MarkDirty calls sent without waiting for their replies */
+    uint32_t pipelined;
+
+    struct hiomap_gaps gaps;
+    /* Modelled Flush and Erase costs, for the idle flush floor */
+    struct hiomap_histogram writeback_latency;
+    /* When the idle flush fires, or 0 if it is not armed */
+    uint64_t idle_at;
+
+    /* Bytes of flash in the shadow, and the time they were counted to */
+    uint64_t shadow_filled;
+    uint64_t shadow_time;
+};
+
+static uint16_t hiomap_sim_le16(const uint8_t* buf)
+{
+    uint16_t v;
+
+    memcpy(&v, buf, sizeof(v));
+
+    return le16toh(v);
+}
+
+static uint32_t hiomap_sim_le32(const uint8_t* buf)
+{
+    uint32_t v;
+
+    memcpy(&v, buf, sizeof(v));
+
+    return le32toh(v);
+}
+
+static uint64_t hiomap_sim_dbus(struct hiomap_sim* sim)
+{
+    sim->result->dbus_calls++;
+
+    return sim->model->dbus_us;
+}
+
+static uint64_t hiomap_sim_read(struct hiomap_sim* sim, uint64_t bytes)
+{
+    sim->result->flash_read_bytes += bytes;
+
+    return bytes * sim->model->read_us_per_kib / 1024;
+}
+
+/* Erase and program whole erase blocks, as hiomapd and the backend do */
+static uint64_t hiomap_sim_writeback(struct hiomap_sim* sim, uint64_t blocks)
+{
+    uint64_t bytes = blocks * sim->erase_size;
+
+    sim->result->flash_erases += blocks;
+    sim->result->flash_program_bytes += bytes;
+
+    return blocks * sim->model->erase_us +
+           bytes * sim->model->program_us_per_kib / 1024;
+}
+
+static void hiomap_sim_blocks(const struct hiomap_sim* sim, uint64_t offset,
+                              uint64_t len, std::set<uint32_t>& blocks)
+{
+    for (uint64_t block = offset / sim->erase_size;
+         block * sim->erase_size < offset + len; block++)
+    {
+        blocks.insert(block);
+    }
+}
+
+/* Open a window, reading it from flash unless hiomapd still has it */
+static uint64_t hiomap_sim_load_window(struct hiomap_sim* sim,
+                                       uint32_t offset, uint32_t size)
+{
+    auto& loaded = sim->loaded;
+
+    for (auto it = loaded.begin(); it != loaded.end(); it++)
+    {
+        if (it->first <= offset &&
+            uint64_t(offset) + size <= uint64_t(it->first) + it->second)
+        {
+            loaded.splice(loaded.begin(), loaded, it);
+            sim->result->window_hits++;
+            return 0;
+        }
+    }
+
+    sim->result->window_misses++;
+
+    loaded.emplace_front(offset, size);
+    while (loaded.size() > sim->model->window_cache)
+    {
+        loaded.pop_back();
+    }
+
+    return hiomap_sim_read(sim, size);
+}
+
+/* Hand held ranges to hiomapd, abandoning any write-back in progress */
+static uint64_t hiomap_sim_release(struct hiomap_sim* sim)
+{
+    uint64_t cost = 0;
+
+    if (sim->settings->pipeline_depth && sim->held_calls)
+    {
+        /* Sent back to back, so one round trip */
+        sim->result->dbus_calls += sim->held_calls;
+        cost = sim->model->dbus_us;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < sim->held_calls; i++)
+        {
+            cost += hiomap_sim_dbus(sim);
+        }
+    }
+
+    sim->held.clear();
+    sim->held_calls = 0;
+    sim->writing_back = false;
+
+    return cost;
+}
+
+static uint64_t hiomap_sim_mark_dirty(struct hiomap_sim* sim,
+                                      uint16_t offset, uint16_t size)
+{
+    const struct hiomap_settings* settings = sim->settings;
+    uint64_t start = uint64_t(offset) << sim->block_size_shift;
+    uint64_t len = uint64_t(size) << sim->block_size_shift;
+    std::set<uint32_t> blocks;
+
+    hiomap_sim_blocks(sim, sim->window.offset + start, len, blocks);
+    sim->dirty.insert(blocks.begin(), blocks.end());
+    sim->dirty_calls++;
+
+    if (hiomap_writeback_should_hold(settings, sim->window.open,
+                                     sim->window.ro,
+                                     sim->window.size >> sim->block_size_shift,
+                                     offset, size))
+    {
+        sim->held.insert(blocks.begin(), blocks.end());
+        sim->held_calls++;
+        return 0;
+    }
+
+    if (hiomap_mark_dirty_pipelines(settings))
+    {
+        sim->result->dbus_calls++;
+        if (++sim->pipelined < settings->pipeline_depth)
+        {
+            return 0;
+        }
+
+        sim->pipelined = 0;
+        return sim->model->dbus_us;
+    }
+
+    return hiomap_sim_dbus(sim);
+}
+
+/* The provider's time handling a command, including waiting on hiomapd */
+static uint64_t hiomap_sim_command(struct hiomap_sim* sim,
+                                   const struct hiomap_trace_entry& entry)
+{
+    const struct hiomap_sim_model* model = sim->model;
+    const std::vector<uint8_t>& resp = entry.resp;
+    const uint8_t* args = &entry.req[2];
+    size_t args_len = entry.req.size() - 2;
+    uint8_t cmd = entry.req[0];
+    uint64_t cost = model->provider_us;
+    std::set<uint32_t> blocks;
+
+    /* Only MarkDirty may overtake queued calls */
+    if (cmd != HIOMAP_C_MARK_DIRTY && sim->pipelined)
+    {
+        sim->pipelined = 0;
+        cost += model->dbus_us;
+    }
+
+    if (!hiomap_writeback_may_overtake(cmd))
+    {
+        cost += hiomap_sim_release(sim);
+    }
+
+    /* The trace says what failed, so don't model any effects */
+    if (entry.cc != HIOMAP_CC_OK)
+    {
+        return cost;
+    }
+
+    switch (cmd)
+    {
+        case HIOMAP_C_RESET:
+            cost += hiomap_sim_dbus(sim);
+            sim->window.open = false;
+            sim->dirty.clear();
+            sim->dirty_calls = 0;
+            break;
+        case HIOMAP_C_GET_INFO:
+            cost += hiomap_sim_dbus(sim);
+            if (resp.size() >= 4)
+            {
+                sim->block_size_shift = resp[3];
+            }
+            break;
+        case HIOMAP_C_GET_FLASH_INFO:
+            cost += hiomap_sim_dbus(sim);
+            if (resp.size() >= 6 && hiomap_sim_le16(&resp[4]))
+            {
+                sim->flash_size = uint32_t(hiomap_sim_le16(&resp[2]))
+                                  << sim->block_size_shift;
+                sim->erase_size = uint32_t(hiomap_sim_le16(&resp[4]))
+                                  << sim->block_size_shift;
+            }
+            break;
+        case HIOMAP_C_CREATE_READ_WINDOW:
+        case HIOMAP_C_CREATE_WRITE_WINDOW:
+        {
+            if (args_len < 4)
+            {
+                break;
+            }
+
+            bool ro = cmd == HIOMAP_C_CREATE_READ_WINDOW;
+            uint16_t offset = hiomap_sim_le16(&args[0]);
+            uint16_t size = hiomap_sim_le16(&args[2]);
+
+            if (ro)
+            {
+                size = hiomap_readahead_size(
+                    &sim->readahead, sim->settings, sim->block_size_shift,
+                    sim->flash_size >> sim->block_size_shift, offset, size);
+                sim->readahead.next = offset + size;
+            }
+
+            uint32_t start = uint32_t(offset) << sim->block_size_shift;
+            uint32_t len = uint32_t(size) << sim->block_size_shift;
+            if (start < sim->flash_size)
+            {
+                len = std::min(len, sim->flash_size - start);
+            }
+
+            cost += hiomap_sim_dbus(sim);
+            cost += hiomap_sim_load_window(sim, start, len);
+
+            sim->window.open = true;
+            sim->window.ro = ro;
+            sim->window.offset = start;
+            sim->window.size = len;
+            break;
+        }
+        case HIOMAP_C_CLOSE_WINDOW:
+            cost += hiomap_sim_dbus(sim);
+            sim->window.open = false;
+            break;
+        case HIOMAP_C_MARK_DIRTY:
+            if (args_len >= 4)
+            {
+                cost += hiomap_sim_mark_dirty(sim, hiomap_sim_le16(&args[0]),
+                                              hiomap_sim_le16(&args[2]));
+            }
+            break;
+        case HIOMAP_C_FLUSH:
+            cost += hiomap_sim_dbus(sim);
+            cost += hiomap_sim_writeback(sim, sim->dirty.size());
+            sim->dirty.clear();
+            sim->dirty_calls = 0;
+            break;
+        case HIOMAP_C_ACK:
+            cost += hiomap_sim_dbus(sim);
+            break;
+        case HIOMAP_C_ERASE:
+            if (args_len >= 4)
+            {
+                hiomap_sim_blocks(
+                    sim,
+                    sim->window.offset + (uint64_t(hiomap_sim_le16(&args[0]))
+                                          << sim->block_size_shift),
+                    uint64_t(hiomap_sim_le16(&args[2]))
+                        << sim->block_size_shift,
+                    blocks);
+                sim->dirty.insert(blocks.begin(), blocks.end());
+                sim->dirty_calls++;
+            }
+            cost += hiomap_sim_dbus(sim);
+            break;
+        case HIOMAP_C_OEM_READ:
+        {
+            if (args_len < 5)
+            {
+                break;
+            }
+
+            uint64_t offset = hiomap_sim_le32(&args[0]);
+            uint64_t len = args[4];
+
+            if (!sim->settings->flash_shadow)
+            {
+                cost += hiomap_sim_read(sim, len);
+            }
+            else if (offset + len <= sim->shadow_filled)
+            {
+                sim->result->shadow_hits++;
+                cost += len * model->shadow_us_per_kib / 1024;
+            }
+            else
+            {
+                sim->result->shadow_misses++;
+                cost += hiomap_sim_read(sim, len);
+            }
+            break;
+        }
+        case HIOMAP_C_OEM_WRITE:
+            if (args_len < 5)
+            {
+                break;
+            }
+
+            /* The backend fetches each block to skip unchanged ones */
+            hiomap_sim_blocks(sim, hiomap_sim_le32(&args[0]), args_len - 4,
+                              blocks);
+            cost += hiomap_sim_read(sim, blocks.size() * sim->erase_size);
+            cost += hiomap_sim_writeback(sim, blocks.size());
+
+            /* Suspend and Resume, after which hiomapd reloads every window */
+            cost += 2 * hiomap_sim_dbus(sim);
+            sim->loaded.clear();
+            break;
+        case HIOMAP_C_OEM_DELTA_APPLY:
+        {
+            if (resp.size() < 7)
+            {
+                break;
+            }
+
+            /* Only the BMC saw the flash contents, so take its word */
+            uint8_t status = resp[2];
+            uint16_t rewritten = hiomap_sim_le16(&resp[3]);
+            uint16_t unchanged = hiomap_sim_le16(&resp[5]);
+
+            /*
+             * Starting the apply suspends hiomapd. Later reports of progress
+             * carry counts, as a step runs between any two commands.
+             */
+            if (status == HIOMAP_DELTA_STATUS_RUNNING)
+            {
+                if (!rewritten && !unchanged)
+                {
+                    cost += hiomap_sim_dbus(sim);
+                }
+                break;
+            }
+
+            /*
+             * The apply ran in the background while the host polled, so the
+             * recorded polls already carry its time; count only the work
+             */
+            if (rewritten || unchanged)
+            {
+                hiomap_sim_read(sim, uint64_t(rewritten + unchanged) *
+                                         sim->erase_size);
+                hiomap_sim_writeback(sim, rewritten);
+                hiomap_sim_dbus(sim);
+            }
+
+            if (rewritten)
+            {
+                sim->loaded.clear();
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return cost;
+}
+
+/* Run the idle flush and write-back steps that start before until */
+static void hiomap_sim_background(struct hiomap_sim* sim, uint64_t until)
+{
+    for (;;)
+    {
+        if (sim->writing_back)
+        {
+            if (sim->busy_until >= until)
+            {
+                break;
+            }
+
+            /* MarkDirty on the next block, then Flush what hiomapd knows */
+            uint32_t block = *sim->held.begin();
+            uint64_t blocks = sim->dirty.size() - sim->held.size() + 1;
+            uint64_t cost = hiomap_sim_dbus(sim) + hiomap_sim_dbus(sim) +
+                            hiomap_sim_writeback(sim, blocks);
+
+            sim->held.erase(block);
+            sim->held_calls =
+                std::min<uint64_t>(sim->held_calls, sim->held.size());
+            sim->dirty = sim->held;
+            sim->busy_until += cost;
+            hiomap_writeback_latency_record(&sim->writeback_latency,
+                                            sim->settings, cost);
+
+            if (sim->held.empty())
+            {
+                sim->dirty_calls = 0;
+                sim->writing_back = false;
+                sim->result->idle_flushes++;
+            }
+            continue;
+        }
+
+        if (!sim->idle_at || sim->idle_at >= until)
+        {
+            break;
+        }
+
+        uint64_t start = std::max(sim->idle_at, sim->busy_until);
+        uint64_t cost = 0;
+
+        sim->idle_at = 0;
+
+        if (sim->pipelined)
+        {
+            sim->pipelined = 0;
+            cost += sim->model->dbus_us;
+        }
+
+        if (!sim->dirty.empty() && sim->window.open && !sim->window.ro)
+        {
+            if (!sim->held.empty())
+            {
+                sim->writing_back = true;
+            }
+            else
+            {
+                uint64_t flush = hiomap_sim_dbus(sim) +
+                                 hiomap_sim_writeback(sim, sim->dirty.size());
+
+                cost += flush;
+                hiomap_writeback_latency_record(&sim->writeback_latency,
+                                                sim->settings, flush);
+                sim->dirty.clear();
+                sim->dirty_calls = 0;
+                sim->result->idle_flushes++;
+            }
+        }
+
+        sim->busy_until = start + cost;
+    }
+}
+
+/*
+ * The shadow fills from flash whenever the provider has nothing else to do,
+ * until it holds the flash or the memory budget runs out
+ */
+static void hiomap_sim_fill_shadow(struct hiomap_sim* sim, uint64_t until)
+{
+    uint64_t from = std::max(sim->busy_until, sim->shadow_time);
+    uint64_t rate = sim->model->read_us_per_kib;
+    uint32_t ratio = sim->model->shadow_ratio;
+    uint64_t capacity = sim->flash_size;
+
+    if (sim->settings->memory_budget)
+    {
+        capacity = std::min<uint64_t>(
+            capacity, uint64_t(sim->settings->memory_budget) * 100 / ratio);
+    }
+
+    if (!sim->settings->flash_shadow || until <= from ||
+        sim->shadow_filled >= capacity)
+    {
+        return;
+    }
+
+    uint64_t bytes = rate ? (until - from) * 1024 / rate : capacity;
+    bytes = std::min<uint64_t>(bytes, capacity - sim->shadow_filled);
+
+    sim->result->flash_read_bytes += bytes;
+    sim->shadow_filled += bytes;
+    sim->shadow_time = until;
+    sim->result->memory_bytes = sim->shadow_filled * ratio / 100;
+}
+
+/* As hiomap_idle_rearm() */
+static void hiomap_sim_idle_rearm(struct hiomap_sim* sim, uint64_t now)
+{
+    if (!sim->settings->idle_flush || sim->dirty.empty())
+    {
+        sim->idle_at = 0;
+        return;
+    }
+
+    sim->idle_at = now + hiomap_idle_delay(sim->settings, &sim->gaps,
+                                           &sim->writeback_latency,
+                                           sim->dirty_calls);
+}
+
+void hiomap_sim_run(const std::vector<struct hiomap_trace_entry>& trace,
+                    const struct hiomap_sim_model* model,
+                    const struct hiomap_settings* settings,
+                    struct hiomap_sim_result* result)
+{
+    struct hiomap_sim sim = {};
+    uint64_t finish = 0;
+
+    *result = {};
+
+    sim.model = model;
+    sim.settings = settings;
+    sim.result = result;
+    sim.block_size_shift = __builtin_ctz(model->block_size);
+    sim.erase_size = model->erase_size;
+    sim.flash_size = model->flash_size;
+
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        const struct hiomap_trace_entry& entry = trace[i];
+        uint64_t think = 0;
+
+        /* The time the host took to send its next command, as recorded */
+        if (i)
+        {
+            const struct hiomap_trace_entry& prev = trace[i - 1];
+            uint64_t done = prev.arrival_us + prev.service_us;
+
+            think = entry.arrival_us > done ? entry.arrival_us - done : 0;
+        }
+
+        uint64_t arrival = finish + think;
+
+        hiomap_sim_background(&sim, arrival);
+        hiomap_sim_fill_shadow(&sim, arrival);
+        hiomap_gaps_record(&sim.gaps, arrival);
+
+        uint64_t start = std::max(arrival, sim.busy_until);
+        finish = start + hiomap_sim_command(&sim, entry);
+        sim.busy_until = finish;
+        sim.shadow_time = finish;
+
+        uint8_t cmd = entry.req[0];
+        if (entry.cc == HIOMAP_CC_OK &&
+            (cmd == HIOMAP_C_FLUSH || cmd == HIOMAP_C_ERASE))
+        {
+            hiomap_writeback_latency_record(&sim.writeback_latency, settings,
+                                            finish - start);
+        }
+        struct hiomap_command_stats* cs = &result->predicted[cmd];
+        if (entry.cc != HIOMAP_CC_OK)
+        {
+            cs->errors++;
+        }
+        hiomap_histogram_record(&cs->latency,
+                                model->transport_us + finish - arrival);
+        hiomap_histogram_record(&result->latency,
+                                model->transport_us + finish - arrival);
+        hiomap_histogram_record(&result->recorded[cmd],
+                                model->transport_us + entry.service_us);
+
+        hiomap_sim_idle_rearm(&sim, finish);
+    }
+
+    if (!trace.empty())
+    {
+        const struct hiomap_trace_entry& last = trace.back();
+
+        result->predicted_us = finish + model->transport_us;
+        result->recorded_us = last.arrival_us + last.service_us -
+                              trace.front().arrival_us + model->transport_us;
+    }
+}
+
+static bool hiomap_sim_better(const struct hiomap_sim_candidate& a,
+                              const struct hiomap_sim_candidate& b)
+{
+    return std::tie(a.p99_us, a.mean_us, a.memory_bytes, a.changes) <
+           std::tie(b.p99_us, b.mean_us, b.memory_bytes, b.changes);
+}
+
+int hiomap_sim_tune(const std::vector<struct hiomap_trace_entry>& trace,
+                    const struct hiomap_sim_model* model,
+                    const struct hiomap_settings* base,
+                    const std::vector<struct hiomap_sim_sweep>& sweeps,
+                    uint64_t memory_cap,
+                    std::vector<struct hiomap_sim_candidate>& ranked)
+{
+    std::vector<std::vector<std::string>> assignments(sweeps.size());
+
+    /* Catch mistakes up front rather than as a combination rejected */
+    for (size_t i = 0; i < sweeps.size(); i++)
+    {
+        for (uint32_t value : sweeps[i].values)
+        {
+            struct hiomap_settings settings = *base;
+            std::string assignment =
+                sweeps[i].name + "=" + std::to_string(value);
+
+            int rc = hiomap_settings_assign(&settings, assignment.c_str());
+            if (rc < 0)
+            {
+                return rc;
+            }
+
+            assignments[i].push_back(assignment);
+        }
+
+        if (assignments[i].empty())
+        {
+            return -EINVAL;
+        }
+    }
+
+    auto result = std::make_unique<struct hiomap_sim_result>();
+    std::vector<size_t> index(sweeps.size());
+
+    ranked.clear();
+
+    for (;;)
+    {
+        struct hiomap_sim_candidate candidate = {};
+        bool valid = true;
+
+        candidate.settings = *base;
+        for (size_t i = 0; i < sweeps.size(); i++)
+        {
+            const std::string& assignment = assignments[i][index[i]];
+            struct hiomap_settings alone = *base;
+
+            valid = valid && !hiomap_settings_assign(&candidate.settings,
+                                                     assignment.c_str());
+            candidate.assignments.push_back(assignment);
+
+            /* The settings are all plain integers */
+            hiomap_settings_assign(&alone, assignment.c_str());
+            if (memcmp(&alone, base, sizeof(alone)))
+            {
+                candidate.changes++;
+            }
+        }
+
+        if (valid)
+        {
+            hiomap_sim_run(trace, model, &candidate.settings, result.get());
+
+            candidate.p99_us =
+                hiomap_histogram_quantile(&result->latency, 0.99);
+            candidate.mean_us =
+                result->latency.count
+                    ? result->latency.sum_us / result->latency.count
+                    : 0;
+            candidate.memory_bytes = result->memory_bytes;
+
+            if (candidate.memory_bytes <= memory_cap)
+            {
+                ranked.push_back(std::move(candidate));
+            }
+        }
+
+        /* Step to the next combination, the last sweep fastest */
+        size_t i = sweeps.size();
+        while (i && ++index[i - 1] == assignments[i - 1].size())
+        {
+            index[--i] = 0;
+        }
+
+        if (!i)
+        {
+            break;
+        }
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(), hiomap_sim_better);
+
+    return 0;
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_SIM_H
+#define HIOMAP_SIM_H
+
+#include "settings.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * What the operations behind a host command cost. Times are in
+ * microseconds, per KiB where the name says so.
+ */
+struct hiomap_sim_model
+{
+    /* Carrying a command to the provider and its response back */
+    uint32_t transport_us = 100;
+    /* A method call to hiomapd and its reply */
+    uint32_t dbus_us = 250;
+    /* The provider's own handling of a command */
+    uint32_t provider_us = 10;
+
+    uint32_t read_us_per_kib = 40;
+    uint32_t program_us_per_kib = 500;
+    /* Per erase block */
+    uint32_t erase_us = 25000;
+    uint32_t shadow_us_per_kib = 2;
+    /* Compressed size of the shadow, as a percentage of the flash it holds */
+    uint32_t shadow_ratio = 50;
+
+    /* Windows hiomapd keeps loaded, so reopening them skips the flash */
+    uint32_t window_cache = 1;
+
+    /* Geometry in bytes, until GetInfo and GetFlashInfo in the trace say */
+    uint32_t block_size = 4 << 10;
+    uint32_t erase_size = 64 << 10;
+    uint32_t flash_size = 64 << 20;
+};
+
+struct hiomap_sim_result
+{
+    /* Host-visible latency, indexed by command */
+    std::array<struct hiomap_command_stats, 256> predicted;
+    /* As recorded, with the modelled transport time added */
+    std::array<struct hiomap_histogram, 256> recorded;
+    /* Host-visible latency of every command together */
+    struct hiomap_histogram latency;
+
+    uint64_t predicted_us;
+    uint64_t recorded_us;
+
+    uint64_t dbus_calls;
+    uint64_t flash_read_bytes;
+    uint64_t flash_program_bytes;
+    uint64_t flash_erases;
+    uint64_t window_hits;
+    uint64_t window_misses;
+    uint64_t shadow_hits;
+    uint64_t shadow_misses;
+    uint64_t idle_flushes;
+
+    /* Most memory the caches held */
+    uint64_t memory_bytes;
+};
+
+/* The values to try for a setting when tuning */
+struct hiomap_sim_sweep
+{
+    std::string name;
+    std::vector<uint32_t> values;
+};
+
+struct hiomap_sim_candidate
+{
+    struct hiomap_settings settings;
+    /* The swept settings, as NAME=VALUE */
+    std::vector<std::string> assignments;
+    uint64_t p99_us;
+    uint64_t mean_us;
+    uint64_t memory_bytes;
+    /* Swept settings that differ from the base */
+    size_t changes;
+};
+
+/* Apply a NAME=VALUE assignment to model. Returns 0 or a negative errno. */
+int hiomap_sim_model_assign(struct hiomap_sim_model* model,
+                            const char* assignment);
+
+/*
+ * Replay trace against a provider with the given settings. The host is
+ * assumed to wait as long after each response as it did when the trace was
+ * recorded, so a faster provider also brings later commands forward.
+ */
+void hiomap_sim_run(const std::vector<struct hiomap_trace_entry>& trace,
+                    const struct hiomap_sim_model* model,
+                    const struct hiomap_settings* settings,
+                    struct hiomap_sim_result* result);
+
+/*
+ * Replay trace under every combination of the swept values applied to base,
+ * and rank those keeping memory use within memory_cap bytes by p99 latency,
+ * then mean latency, then memory use, then the fewest changes from base.
+ * Combinations the settings reject are skipped.
+ *
+ * Returns 0 on success, or a negative errno if a sweep names an unknown
+ * setting or a value out of its range.
+ */
+int hiomap_sim_tune(const std::vector<struct hiomap_trace_entry>& trace,
+                    const struct hiomap_sim_model* model,
+                    const struct hiomap_settings* base,
+                    const std::vector<struct hiomap_sim_sweep>& sweeps,
+                    uint64_t memory_cap,
+                    std::vector<struct hiomap_sim_candidate>& ranked);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_SIM_H */
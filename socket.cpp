@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "socket.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <phosphor-logging/log.hpp>
+
+namespace openpower
+{
+namespace flash
+{
+
+static void hiomap_socket_drop(struct hiomap_socket_client* client)
+{
+    struct hiomap_socket* server = client->server;
+
+    sd_event_source_unref(client->source);
+    close(client->fd);
+
+    server->clients.remove_if([=](const struct hiomap_socket_client& c) {
+        return &c == client;
+    });
+}
+
+static int hiomap_socket_client_event(sd_event_source* source, int fd,
+                                      uint32_t revents, void* userdata)
+{
+    using namespace phosphor::logging;
+
+    struct hiomap_socket_client* client =
+        static_cast<struct hiomap_socket_client*>(userdata);
+    uint8_t req[HIOMAP_SOCK_MSG_MAX];
+    uint8_t resp[HIOMAP_SOCK_MSG_MAX];
+
+    ssize_t len = recv(fd, req, sizeof(req), MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+        return 0;
+    }
+
+    if (len <= 0 || (revents & (EPOLLHUP | EPOLLERR)))
+    {
+        hiomap_socket_drop(client);
+        return 0;
+    }
+
+    if (req[0] != HIOMAP_SOCK_MSG_REQUEST)
+    {
+        log<level::WARNING>("Dropping unexpected HIOMAP socket message",
+                            entry("TYPE=0x%x", req[0]));
+        return 0;
+    }
+
+    size_t resp_len = sizeof(resp) - 2;
+    int cc = hiomap_handle(client->server->ctx, req + 1, len - 1, resp + 2,
+                           &resp_len);
+
+    resp[0] = HIOMAP_SOCK_MSG_RESPONSE;
+    resp[1] = cc;
+
+    if (send(fd, resp, resp_len + 2, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    {
+        log<level::ERR>("Failed to send HIOMAP socket response",
+                        entry("ERRNO=%d", errno));
+        hiomap_socket_drop(client);
+    }
+
+    return 0;
+}
+
+static int hiomap_socket_accept(sd_event_source* source, int fd,
+                                uint32_t revents, void* userdata)
+{
+    using namespace phosphor::logging;
+
+    struct hiomap_socket* server = static_cast<struct hiomap_socket*>(userdata);
+
+    int client_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0)
+    {
+        return 0;
+    }
+
+    server->clients.push_back({server, client_fd, nullptr});
+    struct hiomap_socket_client* client = &server->clients.back();
+
+    int rc = sd_event_add_io(sd_event_source_get_event(source),
+                             &client->source, client_fd, EPOLLIN,
+                             hiomap_socket_client_event, client);
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to watch HIOMAP socket client",
+                        entry("ERRNO=%d", -rc));
+        close(client_fd);
+        server->clients.pop_back();
+    }
+
+    return 0;
+}
+
+int hiomap_socket_init(struct hiomap_socket* server, sd_event* event,
+                       const char* path)
+{
+    struct sockaddr_un addr = {};
+    int rc;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -ENAMETOOLONG;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    unlink(path);
+
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(fd, 4) < 0)
+    {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    rc = sd_event_add_io(event, &server->source, fd, EPOLLIN,
+                         hiomap_socket_accept, server);
+    if (rc < 0)
+    {
+        close(fd);
+        return rc;
+    }
+
+    server->fd = fd;
+
+    return 0;
+}
+
+void hiomap_socket_notify(struct hiomap_socket* server, uint8_t events)
+{
+    uint8_t msg[] = {HIOMAP_SOCK_MSG_EVENT, events};
+
+    for (auto it = server->clients.begin(); it != server->clients.end();)
+    {
+        struct hiomap_socket_client* client = &*it++;
+
+        if (send(client->fd, msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        {
+            hiomap_event_failed(server->ctx);
+            hiomap_socket_drop(client);
+        }
+    }
+}
+
+} // namespace flash
+} // namespace openpower
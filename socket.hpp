@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_SOCKET_H
+#define HIOMAP_SOCKET_H
+
+#include "hiomap.hpp"
+
+#include <systemd/sd-event.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+
+/*
+ * HIOMAP over a Unix SOCK_SEQPACKET socket, for hosts, emulators and tests
+ * that have no IPMI path to the BMC. Each packet starts with its type:
+ *
+ *   request:  [HIOMAP_SOCK_MSG_REQUEST][command][sequence][arguments...]
+ *   response: [HIOMAP_SOCK_MSG_RESPONSE][cc][command][sequence][data...]
+ *   event:    [HIOMAP_SOCK_MSG_EVENT][BMC event flags]
+ *
+ * Failed requests get a response carrying only the completion code. Event
+ * updates are sent to every connected client.
+ */
+#define HIOMAP_SOCK_MSG_REQUEST 0x01
+#define HIOMAP_SOCK_MSG_RESPONSE 0x02
+#define HIOMAP_SOCK_MSG_EVENT 0x03
+
+/* Largest packet either side will send */
+#define HIOMAP_SOCK_MSG_MAX 4096
+
+namespace openpower
+{
+namespace flash
+{
+
+struct hiomap_socket;
+
+struct hiomap_socket_client
+{
+    struct hiomap_socket* server;
+    int fd;
+    sd_event_source* source;
+};
+
+struct hiomap_socket
+{
+    struct hiomap* ctx;
+    int fd;
+    sd_event_source* source;
+    std::list<struct hiomap_socket_client> clients;
+};
+
+/*
+ * Listen at path, replacing any stale socket there. Requests are handed to
+ * server->ctx, which the caller must set before running the event loop.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_socket_init(struct hiomap_socket* server, sd_event* event,
+                       const char* path);
+
+/* Send an event update to every client; usable as the core's notify hook */
+void hiomap_socket_notify(struct hiomap_socket* server, uint8_t events);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_SOCKET_H */
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "hiomap.hpp"
+#include "socket.hpp"
+
+#include <systemd/sd-event.h>
+
+#include <cstdlib>
+#include <functional>
+#include <phosphor-logging/log.hpp>
+#include <sdbusplus/bus.hpp>
+
+/*
+ * Serves HIOMAP on a Unix socket instead of through ipmid. This is a
+ * separate front end to hiomapd, not a companion to the IPMI provider: run
+ * one or the other against a given hiomapd instance.
+ */
+
+using namespace openpower::flash;
+using namespace phosphor::logging;
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : HIOMAP_SOCKET_PATH;
+    struct hiomap_socket server = {};
+    sd_event* event = nullptr;
+    int rc;
+
+    rc = sd_event_default(&event);
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to create event loop", entry("ERRNO=%d", -rc));
+        return EXIT_FAILURE;
+    }
+
+    auto bus = sdbusplus::bus::new_default();
+    bus.attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+
+    rc = hiomap_socket_init(&server, event, path);
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to listen for HIOMAP clients",
+                        entry("PATH=%s", path), entry("ERRNO=%d", -rc));
+        return EXIT_FAILURE;
+    }
+
+    server.ctx = hiomap_new(&bus, event, [&server](struct hiomap*, uint8_t e) {
+        hiomap_socket_notify(&server, e);
+    });
+
+    rc = sd_event_loop(event);
+
+    sd_event_unref(event);
+
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
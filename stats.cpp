@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "stats.hpp"
+
+#include "hiomap.hpp"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+namespace openpower
+{
+namespace flash
+{
+
+void hiomap_histogram_record(struct hiomap_histogram* hist, uint64_t us)
+{
+    size_t i = 0;
+
+    while (i < hiomap_latency_bounds_us.size() &&
+           us > hiomap_latency_bounds_us[i])
+    {
+        i++;
+    }
+
+    hist->buckets[i]++;
+    hist->count++;
+    hist->sum_us += us;
+}
+
+void hiomap_histogram_decay(struct hiomap_histogram* hist)
+{
+    uint64_t count = 0;
+
+    for (auto& bucket : hist->buckets)
+    {
+        bucket /= 2;
+        count += bucket;
+    }
+
+    hist->sum_us = hist->count ? hist->sum_us * count / hist->count : 0;
+    hist->count = count;
+}
+
+uint64_t hiomap_histogram_quantile(const struct hiomap_histogram* hist,
+                                   double q)
+{
+    if (!hist->count)
+    {
+        return 0;
+    }
+
+    double rank = q * hist->count;
+    uint64_t cumulative = 0;
+    uint64_t lower = 0;
+
+    for (size_t i = 0; i < hiomap_latency_bounds_us.size(); i++)
+    {
+        uint64_t upper = hiomap_latency_bounds_us[i];
+        uint64_t n = hist->buckets[i];
+
+        if (n && cumulative + n >= rank)
+        {
+            return lower + (upper - lower) * (rank - cumulative) / n;
+        }
+
+        cumulative += n;
+        lower = upper;
+    }
+
+    return 2 * lower;
+}
+
+const char* hiomap_command_name(uint8_t cmd)
+{
+    switch (cmd)
+    {
+        case HIOMAP_C_RESET:
+            return "reset";
+        case HIOMAP_C_GET_INFO:
+            return "get_info";
+        case HIOMAP_C_GET_FLASH_INFO:
+            return "get_flash_info";
+        case HIOMAP_C_CREATE_READ_WINDOW:
+            return "create_read_window";
+        case HIOMAP_C_CLOSE_WINDOW:
+            return "close_window";
+        case HIOMAP_C_CREATE_WRITE_WINDOW:
+            return "create_write_window";
+        case HIOMAP_C_MARK_DIRTY:
+            return "mark_dirty";
+        case HIOMAP_C_FLUSH:
+            return "flush";
+        case HIOMAP_C_ACK:
+            return "ack";
+        case HIOMAP_C_ERASE:
+            return "erase";
+        case HIOMAP_C_OEM_GET_EVENTS:
+            return "oem_get_events";
+        case HIOMAP_C_OEM_READ:
+            return "oem_read";
+        case HIOMAP_C_OEM_WRITE:
+            return "oem_write";
+        case HIOMAP_C_OEM_DELTA_START:
+            return "oem_delta_start";
+        case HIOMAP_C_OEM_DELTA_DATA:
+            return "oem_delta_data";
+        case HIOMAP_C_OEM_DELTA_APPLY:
+            return "oem_delta_apply";
+        default:
+            return nullptr;
+    }
+}
+
+static void hiomap_emit_counter(std::string& out, const char* name,
+                                const char* help, uint64_t value)
+{
+    char line[160];
+
+    out += "# TYPE ";
+    out += name;
+    out += " counter\n# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n";
+
+    snprintf(line, sizeof(line), "%s_total %" PRIu64 "\n", name, value);
+    out += line;
+}
+
+static void hiomap_emit_gauge(std::string& out, const char* name,
+                              const char* help, uint64_t value)
+{
+    char line[160];
+
+    out += "# TYPE ";
+    out += name;
+    out += " gauge\n# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n";
+
+    snprintf(line, sizeof(line), "%s %" PRIu64 "\n", name, value);
+    out += line;
+}
+
+static void hiomap_emit_commands(std::string& out,
+                                 const struct hiomap_stats* stats)
+{
+    char line[160];
+
+    out += "# TYPE hiomap_command_errors counter\n"
+           "# HELP hiomap_command_errors HIOMAP commands that failed.\n";
+    for (size_t cmd = 0; cmd < stats->commands.size(); cmd++)
+    {
+        const char* name = hiomap_command_name(cmd);
+
+        if (!name)
+        {
+            continue;
+        }
+
+        snprintf(line, sizeof(line),
+                 "hiomap_command_errors_total{command=\"%s\"} %" PRIu64 "\n",
+                 name, stats->commands[cmd].errors);
+        out += line;
+    }
+
+    out += "# TYPE hiomap_command_latency_seconds histogram\n"
+           "# HELP hiomap_command_latency_seconds HIOMAP command service "
+           "time.\n";
+    for (size_t cmd = 0; cmd < stats->commands.size(); cmd++)
+    {
+        const struct hiomap_histogram* hist = &stats->commands[cmd].latency;
+        const char* name = hiomap_command_name(cmd);
+        uint64_t cumulative = 0;
+
+        if (!name)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < hiomap_latency_bounds_us.size(); i++)
+        {
+            cumulative += hist->buckets[i];
+            snprintf(line, sizeof(line),
+                     "hiomap_command_latency_seconds_bucket{command=\"%s\","
+                     "le=\"%g\"} %" PRIu64 "\n",
+                     name, hiomap_latency_bounds_us[i] / 1e6, cumulative);
+            out += line;
+        }
+
+        snprintf(line, sizeof(line),
+                 "hiomap_command_latency_seconds_bucket{command=\"%s\","
+                 "le=\"+Inf\"} %" PRIu64 "\n",
+                 name, hist->count);
+        out += line;
+        snprintf(line, sizeof(line),
+                 "hiomap_command_latency_seconds_sum{command=\"%s\"} %g\n",
+                 name, hist->sum_us / 1e6);
+        out += line;
+        snprintf(line, sizeof(line),
+                 "hiomap_command_latency_seconds_count{command=\"%s\"} "
+                 "%" PRIu64 "\n",
+                 name, hist->count);
+        out += line;
+    }
+}
+
+int hiomap_stats_export(const struct hiomap_stats* stats, const char* path)
+{
+    std::string out;
+
+    hiomap_emit_commands(out, stats);
+    hiomap_emit_counter(out, "hiomap_events_sent",
+                        "BMC event updates sent to the host.",
+                        stats->events_sent);
+    hiomap_emit_counter(out, "hiomap_events_failed",
+                        "BMC event updates the host did not accept.",
+                        stats->events_failed);
+    hiomap_emit_counter(out, "hiomap_windows_inflated",
+                        "Read windows enlarged for sequential readers.",
+                        stats->windows_inflated);
+    hiomap_emit_gauge(out, "hiomap_shadow_bytes",
+                      "Compressed flash contents held in RAM.",
+                      stats->shadow_bytes);
+    hiomap_emit_gauge(out, "hiomap_shadow_shared_bytes",
+                      "Shadow contents published by other hosts' instances.",
+                      stats->shadow_shared_bytes);
+    hiomap_emit_counter(out, "hiomap_shadow_hits",
+                        "Flash reads served from the RAM shadow.",
+                        stats->shadow_hits);
+    hiomap_emit_counter(out, "hiomap_shadow_misses",
+                        "Flash reads that fell through to the device.",
+                        stats->shadow_misses);
+    hiomap_emit_counter(out, "hiomap_pages_programmed",
+                        "Flash pages programmed by the provider.",
+                        stats->pages_programmed);
+    hiomap_emit_counter(out, "hiomap_pages_skipped",
+                        "Erased flash pages not programmed as all-ones.",
+                        stats->pages_skipped);
+    hiomap_emit_counter(out, "hiomap_erases",
+                        "Flash erase commands issued by the provider.",
+                        stats->erases);
+    hiomap_emit_counter(out, "hiomap_blocks_unchanged",
+                        "Erase blocks not rewritten as writes left them as "
+                        "they were.",
+                        stats->blocks_unchanged);
+    hiomap_emit_counter(out, "hiomap_verify_failures",
+                        "Flash blocks that read back differently.",
+                        stats->verify_failures);
+    hiomap_emit_counter(out, "hiomap_rmw_hits",
+                        "Partial block writes that avoided a read-back.",
+                        stats->rmw_hits);
+    hiomap_emit_counter(out, "hiomap_rmw_misses",
+                        "Partial block writes that read the block back.",
+                        stats->rmw_misses);
+    hiomap_emit_counter(out, "hiomap_idle_flushes",
+                        "Dirty windows written back while the host was idle.",
+                        stats->idle_flushes);
+    hiomap_emit_counter(out, "hiomap_pipelined_calls",
+                        "MarkDirty calls sent without waiting.",
+                        stats->pipelined_calls);
+    out += "# EOF\n";
+
+    /* The export directory usually lives on tmpfs and vanishes on reboot */
+    std::string dir(path);
+    mkdir(dirname(&dir[0]), 0755);
+
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    const char* buf = out.data();
+    size_t remaining = out.size();
+    while (remaining)
+    {
+        ssize_t rc = write(fd, buf, remaining);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            int err = errno;
+            close(fd);
+            unlink(tmp.c_str());
+            return -err;
+        }
+
+        buf += rc;
+        remaining -= rc;
+    }
+
+    close(fd);
+
+    if (rename(tmp.c_str(), path) < 0)
+    {
+        int err = errno;
+        unlink(tmp.c_str());
+        return -err;
+    }
+
+    return 0;
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_STATS_H
+#define HIOMAP_STATS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Upper bounds of the latency histogram buckets, in microseconds */
+constexpr std::array<uint32_t, 16> hiomap_latency_bounds_us = {
+    100,    250,    500,    1000,    2500,    5000,    10000,   25000,
+    50000,  100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+struct hiomap_histogram
+{
+    /* One more than the bounds for the +Inf bucket. Not cumulative. */
+    std::array<uint64_t, hiomap_latency_bounds_us.size() + 1> buckets;
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+struct hiomap_command_stats
+{
+    uint64_t errors;
+    struct hiomap_histogram latency;
+};
+
+struct hiomap_stats
+{
+    /* Indexed by HIOMAP command ID */
+    std::array<struct hiomap_command_stats, 256> commands;
+    uint64_t events_sent;
+    uint64_t events_failed;
+    uint64_t windows_inflated;
+    uint64_t shadow_bytes;
+    uint64_t shadow_shared_bytes;
+    uint64_t shadow_hits;
+    uint64_t shadow_misses;
+    uint64_t pages_programmed;
+    uint64_t pages_skipped;
+    uint64_t erases;
+    uint64_t blocks_unchanged;
+    uint64_t verify_failures;
+    uint64_t rmw_hits;
+    uint64_t rmw_misses;
+    uint64_t idle_flushes;
+    uint64_t pipelined_calls;
+};
+
+void hiomap_histogram_record(struct hiomap_histogram* hist, uint64_t us);
+
+/*
+ * Halve every bucket, so that older samples count for less than those
+ * recorded after
+ */
+void hiomap_histogram_decay(struct hiomap_histogram* hist);
+
+/*
+ * Estimate the q-quantile (0 < q <= 1) of the recorded samples in
+ * microseconds, interpolating linearly within the containing bucket.
+ * Samples beyond the last bound are reported as twice that bound.
+ */
+uint64_t hiomap_histogram_quantile(const struct hiomap_histogram* hist,
+                                   double q);
+
+/* The name statistics use for a command, or NULL if it has none */
+const char* hiomap_command_name(uint8_t cmd);
+
+static inline void hiomap_stats_record(struct hiomap_stats* stats,
+                                       uint8_t cmd, int cc, uint64_t us)
+{
+    struct hiomap_command_stats* cs = &stats->commands[cmd];
+
+    if (cc)
+    {
+        cs->errors++;
+    }
+
+    hiomap_histogram_record(&cs->latency, us);
+}
+
+/*
+ * Write the statistics to path in OpenMetrics text format. The file is
+ * written beside path and renamed into place so readers never observe a
+ * partial export.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int hiomap_stats_export(const struct hiomap_stats* stats, const char* path);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_STATS_H */
@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "store.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace openpower
+{
+namespace flash
+{
+
+/* Numbers this process's uses of objects */
+static std::atomic<uint32_t> hiomap_store_uses;
+
+/* FNV-1a. Lookups compare contents, so this only has to spread names */
+static uint64_t hiomap_store_hash(const void* data, size_t len)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (len--)
+    {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void hiomap_store_name(char* name, size_t size, uint64_t hash,
+                              size_t len)
+{
+    snprintf(name, size, "%016" PRIx64 "-%zx", hash, len);
+}
+
+/* The link recording one use of an object by this process */
+static void hiomap_store_use_name(char* name, size_t size, uint64_t hash,
+                                  size_t len, uint32_t use)
+{
+    snprintf(name, size, "%016" PRIx64 "-%zx@%d.%u", hash, len, getpid(),
+             use);
+}
+
+static bool hiomap_store_pid_alive(const char* pid)
+{
+    return kill(strtol(pid, nullptr, 10), 0) == 0 || errno != ESRCH;
+}
+
+/* Remove the object's name if no use of it remains */
+static void hiomap_store_reap(struct hiomap_store* store, const char* name)
+{
+    struct stat st;
+
+    if (!fstatat(store->dirfd, name, &st, AT_SYMLINK_NOFOLLOW) &&
+        st.st_nlink == 1)
+    {
+        unlinkat(store->dirfd, name, 0);
+    }
+}
+
+/*
+ * Remove the uses and half-published temporaries of instances that have
+ * exited, such as by crashing, and then the objects nobody uses any more
+ */
+static void hiomap_store_sweep(struct hiomap_store* store)
+{
+    int fd = dup(store->dirfd);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    DIR* dir = fdopendir(fd);
+    if (!dir)
+    {
+        close(fd);
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)))
+    {
+        const char* at = strchr(entry->d_name, '@');
+
+        if (entry->d_type != DT_REG)
+        {
+            continue;
+        }
+
+        if (!strncmp(entry->d_name, ".tmp-", 5))
+        {
+            at = entry->d_name + 4;
+        }
+
+        if (at && !hiomap_store_pid_alive(at + 1))
+        {
+            unlinkat(store->dirfd, entry->d_name, 0);
+        }
+    }
+
+    rewinddir(dir);
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_type == DT_REG && entry->d_name[0] != '.' &&
+            !strchr(entry->d_name, '@'))
+        {
+            hiomap_store_reap(store, entry->d_name);
+        }
+    }
+
+    closedir(dir);
+}
+
+int hiomap_store_init(struct hiomap_store* store, const char* path)
+{
+    std::string dir(path);
+
+    /* Create the parent too, it's usually under /run */
+    mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);
+    if (mkdir(path, 0700) < 0 && errno != EEXIST)
+    {
+        return -errno;
+    }
+
+    store->dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (store->dirfd < 0)
+    {
+        return -errno;
+    }
+
+    hiomap_store_sweep(store);
+
+    return 0;
+}
+
+void hiomap_store_close(struct hiomap_store* store)
+{
+    if (store->dirfd >= 0)
+    {
+        close(store->dirfd);
+        store->dirfd = -1;
+    }
+}
+
+/*
+ * Map the object through one of our uses of it, checking it has our
+ * contents. The descriptor is closed again: the mapping and the link keep
+ * the object alive.
+ */
+static int hiomap_store_map(struct hiomap_store* store, const char* use_name,
+                            const void* data, size_t len, uint64_t hash,
+                            uint32_t use, struct hiomap_store_object* obj)
+{
+    struct stat st;
+    int rc = 0;
+
+    int fd = openat(store->dirfd, use_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (fstat(fd, &st) < 0)
+    {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    if (static_cast<size_t>(st.st_size) != len)
+    {
+        close(fd);
+        return -EEXIST;
+    }
+
+    void* map = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        rc = -errno;
+    }
+
+    close(fd);
+
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    if (memcmp(map, data, len))
+    {
+        munmap(map, len);
+        return -EEXIST;
+    }
+
+    obj->data = static_cast<const char*>(map);
+    obj->len = len;
+    obj->hash = hash;
+    obj->use = use;
+
+    return 0;
+}
+
+/* Drop one use of an object, removing it if that was the last */
+static void hiomap_store_unuse(struct hiomap_store* store, const char* name,
+                               const char* use_name)
+{
+    unlinkat(store->dirfd, use_name, 0);
+    hiomap_store_reap(store, name);
+}
+
+/*
+ * Write the contents to a private file and link it in under name, recording
+ * our use of it first so that it is never seen unused
+ */
+static int hiomap_store_publish(struct hiomap_store* store, const char* name,
+                                const void* data, size_t len, uint64_t hash,
+                                struct hiomap_store_object* obj)
+{
+    static std::atomic<unsigned> counter;
+    char tmp[64];
+    char use_name[96];
+    uint32_t use = hiomap_store_uses++;
+    int rc = 0;
+
+    snprintf(tmp, sizeof(tmp), ".tmp-%d-%u", getpid(), counter++);
+    hiomap_store_use_name(use_name, sizeof(use_name), hash, len, use);
+
+    int fd = openat(store->dirfd, tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0600);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    const char* cursor = static_cast<const char*>(data);
+    size_t remaining = len;
+
+    while (remaining)
+    {
+        ssize_t written = write(fd, cursor, remaining);
+        if (written < 0)
+        {
+            rc = -errno;
+            break;
+        }
+
+        cursor += written;
+        remaining -= written;
+    }
+
+    close(fd);
+
+    if (!rc && linkat(store->dirfd, tmp, store->dirfd, use_name, 0) < 0)
+    {
+        rc = -errno;
+    }
+    else if (!rc && linkat(store->dirfd, tmp, store->dirfd, name, 0) < 0)
+    {
+        /* EEXIST: someone else published it first */
+        rc = -errno;
+        unlinkat(store->dirfd, use_name, 0);
+    }
+    else if (!rc)
+    {
+        rc = hiomap_store_map(store, use_name, data, len, hash, use, obj);
+        if (rc < 0)
+        {
+            hiomap_store_unuse(store, name, use_name);
+        }
+        else
+        {
+            obj->created = true;
+        }
+    }
+
+    unlinkat(store->dirfd, tmp, 0);
+
+    return rc;
+}
+
+int hiomap_store_get(struct hiomap_store* store, const void* data, size_t len,
+                     bool create, struct hiomap_store_object* obj)
+{
+    uint64_t hash = hiomap_store_hash(data, len);
+    char name[64];
+    char use_name[96];
+    int rc;
+
+    if (store->dirfd < 0)
+    {
+        return -ENODEV;
+    }
+
+    hiomap_store_name(name, sizeof(name), hash, len);
+
+    for (;;)
+    {
+        uint32_t use = hiomap_store_uses++;
+
+        hiomap_store_use_name(use_name, sizeof(use_name), hash, len, use);
+
+        /* Once linked, the object can't be removed from under us */
+        if (!linkat(store->dirfd, name, store->dirfd, use_name, 0))
+        {
+            rc = hiomap_store_map(store, use_name, data, len, hash, use, obj);
+            if (rc < 0)
+            {
+                hiomap_store_unuse(store, name, use_name);
+                return rc;
+            }
+
+            obj->created = false;
+            return 0;
+        }
+
+        if (errno != ENOENT)
+        {
+            return -errno;
+        }
+
+        if (!create)
+        {
+            return -ENOENT;
+        }
+
+        rc = hiomap_store_publish(store, name, data, len, hash, obj);
+        if (rc != -EEXIST)
+        {
+            return rc;
+        }
+    }
+}
+
+void hiomap_store_put(struct hiomap_store* store,
+                      struct hiomap_store_object* obj)
+{
+    char name[64];
+    char use_name[96];
+
+    if (!obj->data)
+    {
+        return;
+    }
+
+    munmap(const_cast<char*>(obj->data), obj->len);
+
+    hiomap_store_name(name, sizeof(name), obj->hash, obj->len);
+    hiomap_store_use_name(use_name, sizeof(use_name), obj->hash, obj->len,
+                          obj->use);
+    hiomap_store_unuse(store, name, use_name);
+
+    obj->data = nullptr;
+    obj->len = 0;
+}
+
+} // namespace flash
+} // namespace openpower
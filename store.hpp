@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_STORE_H
+#define HIOMAP_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * Immutable objects named by a hash of their contents, kept as files in a
+ * tmpfs directory so that every provider instance on the BMC maps the same
+ * pages for the same contents. In a multi-host chassis booting identical
+ * firmware, shadow memory then grows with the number of distinct images
+ * rather than the number of hosts.
+ *
+ * Each use of an object is a hard link to it, named for the object, the
+ * user's pid and a sequence number, so its link count is one more than its
+ * number of users and no descriptor stays open once it is mapped. The last
+ * user to let go removes the object's name. The next instance to start
+ * removes the links of users that have exited without, and the objects they
+ * leave unused. Each user accounts for the memory of the objects it maps, as
+ * it may end up their only user.
+ */
+struct hiomap_store
+{
+    int dirfd;
+};
+
+struct hiomap_store_object
+{
+    const char* data = nullptr;
+    size_t len = 0;
+    uint64_t hash = 0;
+    /* Sequence number naming this use's link */
+    uint32_t use = 0;
+    /* This instance published the object rather than finding it */
+    bool created = false;
+};
+
+/*
+ * Open the store, creating it if need be, and remove whatever no instance
+ * holds. Returns 0 on success or a negative errno.
+ */
+int hiomap_store_init(struct hiomap_store* store, const char* path);
+
+void hiomap_store_close(struct hiomap_store* store);
+
+/*
+ * Map the object holding exactly the len bytes at data, publishing it first
+ * if no instance has yet and create is set. Contents are compared on lookup,
+ * so a hash collision is a failure rather than corruption.
+ *
+ * Returns 0 on success or a negative errno; -ENOENT if the object does not
+ * exist and create is clear.
+ */
+int hiomap_store_get(struct hiomap_store* store, const void* data, size_t len,
+                     bool create, struct hiomap_store_object* obj);
+
+/* Unmap the object, removing it if no other instance has it mapped */
+void hiomap_store_put(struct hiomap_store* store,
+                      struct hiomap_store_object* obj);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_STORE_H */
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "budget.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace openpower::flash;
+
+class BudgetTest : public ::testing::Test
+{
+  protected:
+    struct hiomap_budget budget;
+    struct hiomap_budget_client shadow = {};
+    struct hiomap_budget_client rmw = {};
+    struct hiomap_budget_client delta = {};
+    std::vector<std::string> evicted;
+
+    /* A client that frees what it is asked for, as far as it can */
+    void add(struct hiomap_budget_client* client, const char* name,
+             enum hiomap_budget_priority priority)
+    {
+        hiomap_budget_register(&budget, client, name, priority,
+                               [this, client](uint64_t bytes) {
+                                   evicted.push_back(client->name);
+                                   hiomap_budget_release(
+                                       client, std::min<uint64_t>(
+                                                   bytes, client->used));
+                               });
+    }
+
+    void SetUp() override
+    {
+        budget.limit = 0;
+
+        /* Out of order, to check the registration sorts them */
+        add(&delta, "delta", HIOMAP_BUDGET_PRIO_DELTA);
+        add(&shadow, "shadow", HIOMAP_BUDGET_PRIO_SHADOW);
+        add(&rmw, "rmw", HIOMAP_BUDGET_PRIO_RMW);
+    }
+};
+
+TEST_F(BudgetTest, RegisterSortsByPriority)
+{
+    ASSERT_EQ(3u, budget.clients.size());
+    EXPECT_EQ(&shadow, budget.clients[0]);
+    EXPECT_EQ(&rmw, budget.clients[1]);
+    EXPECT_EQ(&delta, budget.clients[2]);
+}
+
+TEST_F(BudgetTest, UnlimitedOnlyCounts)
+{
+    EXPECT_TRUE(hiomap_budget_charge(&shadow, 100));
+    EXPECT_TRUE(hiomap_budget_charge(&delta, 200));
+
+    EXPECT_EQ(300u, hiomap_budget_used(&budget));
+    EXPECT_TRUE(evicted.empty());
+}
+
+TEST_F(BudgetTest, UnregisteredOnlyCounts)
+{
+    struct hiomap_budget_client loose = {};
+
+    budget.limit = 10;
+
+    EXPECT_TRUE(hiomap_budget_charge(&loose, 100));
+    EXPECT_EQ(100u, loose.used);
+}
+
+TEST_F(BudgetTest, ChargeEvictsLowestFirst)
+{
+    budget.limit = 1000;
+    ASSERT_TRUE(hiomap_budget_charge(&shadow, 300));
+    ASSERT_TRUE(hiomap_budget_charge(&rmw, 300));
+    ASSERT_TRUE(hiomap_budget_charge(&delta, 300));
+
+    /* The shadow alone has room enough */
+    EXPECT_TRUE(hiomap_budget_charge(&delta, 200));
+    EXPECT_EQ(std::vector<std::string>{"shadow"}, evicted);
+    EXPECT_EQ(200u, shadow.used);
+    EXPECT_EQ(300u, rmw.used);
+
+    /* Takes the rest of the shadow, then from the RMW cache */
+    evicted.clear();
+    EXPECT_TRUE(hiomap_budget_charge(&delta, 300));
+    EXPECT_EQ((std::vector<std::string>{"shadow", "rmw"}), evicted);
+    EXPECT_EQ(0u, shadow.used);
+    EXPECT_EQ(200u, rmw.used);
+    EXPECT_EQ(1000u, hiomap_budget_used(&budget));
+}
+
+TEST_F(BudgetTest, ChargeSparesEqualAndHigherPriority)
+{
+    budget.limit = 1000;
+    ASSERT_TRUE(hiomap_budget_charge(&rmw, 400));
+    ASSERT_TRUE(hiomap_budget_charge(&delta, 400));
+
+    /* Only the empty shadow is below the charger */
+    EXPECT_FALSE(hiomap_budget_charge(&rmw, 300));
+    EXPECT_EQ(std::vector<std::string>{"shadow"}, evicted);
+    EXPECT_EQ(400u, rmw.used);
+    EXPECT_EQ(400u, delta.used);
+}
+
+TEST_F(BudgetTest, SetLimitEvictsEveryoneInOrder)
+{
+    ASSERT_TRUE(hiomap_budget_charge(&shadow, 300));
+    ASSERT_TRUE(hiomap_budget_charge(&rmw, 300));
+    ASSERT_TRUE(hiomap_budget_charge(&delta, 300));
+
+    hiomap_budget_set_limit(&budget, 200);
+
+    EXPECT_EQ((std::vector<std::string>{"shadow", "rmw", "delta"}), evicted);
+    EXPECT_EQ(200u, hiomap_budget_used(&budget));
+    EXPECT_EQ(200u, delta.used);
+}
+
+TEST_F(BudgetTest, SetLimitStopsOnceUnder)
+{
+    ASSERT_TRUE(hiomap_budget_charge(&shadow, 300));
+    ASSERT_TRUE(hiomap_budget_charge(&rmw, 300));
+
+    hiomap_budget_set_limit(&budget, 400);
+
+    EXPECT_EQ(std::vector<std::string>{"shadow"}, evicted);
+    EXPECT_EQ(100u, shadow.used);
+    EXPECT_EQ(300u, rmw.used);
+}
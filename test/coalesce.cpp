@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "coalesce.hpp"
+
+#include <limits>
+
+#include <gtest/gtest.h>
+
+using namespace openpower::flash;
+
+/* Arrivals gap_us apart, after one to start the clock */
+static void arrive(struct hiomap_gaps* gaps, uint64_t gap_us, size_t n)
+{
+    if (!gaps->last_us)
+    {
+        hiomap_gaps_record(gaps, 1);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        hiomap_gaps_record(gaps, gaps->last_us + gap_us);
+    }
+}
+
+TEST(GapsRecord, FirstArrivalStartsClock)
+{
+    struct hiomap_gaps gaps = {};
+
+    hiomap_gaps_record(&gaps, 1000);
+    EXPECT_EQ(0u, gaps.count);
+
+    hiomap_gaps_record(&gaps, 1500);
+    ASSERT_EQ(1u, gaps.count);
+    EXPECT_EQ(500u, gaps.us[0]);
+}
+
+TEST(GapsRecord, KeepsMostRecent)
+{
+    struct hiomap_gaps gaps = {};
+
+    arrive(&gaps, 100, HIOMAP_GAPS_WINDOW);
+    arrive(&gaps, 900, HIOMAP_GAPS_WINDOW);
+
+    EXPECT_EQ(HIOMAP_GAPS_WINDOW, gaps.count);
+    EXPECT_EQ(900u, hiomap_gaps_quantile(&gaps, 0.0));
+}
+
+TEST(GapsRecord, ClampsLongGaps)
+{
+    struct hiomap_gaps gaps = {};
+
+    arrive(&gaps, uint64_t(1) << 40, 1);
+
+    EXPECT_EQ(std::numeric_limits<uint32_t>::max(), gaps.us[0]);
+}
+
+TEST(GapsQuantile, NeedsMinimumSamples)
+{
+    struct hiomap_gaps gaps = {};
+
+    arrive(&gaps, 100, HIOMAP_GAPS_MIN_SAMPLES - 1);
+    EXPECT_EQ(0u, hiomap_gaps_quantile(&gaps, 0.5));
+
+    arrive(&gaps, 100, 1);
+    EXPECT_EQ(100u, hiomap_gaps_quantile(&gaps, 0.5));
+}
+
+TEST(GapsQuantile, Ranks)
+{
+    struct hiomap_gaps gaps = {};
+
+    for (uint64_t gap = 10; gap <= 100; gap += 10)
+    {
+        arrive(&gaps, gap, 1);
+    }
+
+    EXPECT_EQ(10u, hiomap_gaps_quantile(&gaps, 0.0));
+    EXPECT_EQ(60u, hiomap_gaps_quantile(&gaps, 0.5));
+    EXPECT_EQ(100u, hiomap_gaps_quantile(&gaps, 0.9));
+    EXPECT_EQ(100u, hiomap_gaps_quantile(&gaps, 1.0));
+}
+
+TEST(GapsIdleDelay, FullDelayWithoutEstimate)
+{
+    struct hiomap_gaps gaps = {};
+
+    EXPECT_EQ(200000u, hiomap_gaps_idle_delay(&gaps, 200000, 20000));
+}
+
+TEST(GapsIdleDelay, FollowsUsualGap)
+{
+    struct hiomap_gaps gaps = {};
+
+    arrive(&gaps, 10000, HIOMAP_GAPS_MIN_SAMPLES);
+
+    EXPECT_EQ(40000u, hiomap_gaps_idle_delay(&gaps, 200000, 20000));
+}
+
+TEST(GapsIdleDelay, Bounded)
+{
+    struct hiomap_gaps fast = {};
+    struct hiomap_gaps slow = {};
+
+    arrive(&fast, 100, HIOMAP_GAPS_MIN_SAMPLES);
+    arrive(&slow, 100000, HIOMAP_GAPS_MIN_SAMPLES);
+
+    EXPECT_EQ(20000u, hiomap_gaps_idle_delay(&fast, 200000, 20000));
+    EXPECT_EQ(200000u, hiomap_gaps_idle_delay(&slow, 200000, 20000));
+}
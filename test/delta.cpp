@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "delta.hpp"
+
+#include "hiomap.hpp"
+
+#include <endian.h>
+
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace openpower::flash;
+
+constexpr uint32_t FLASH_SIZE = 64 << 20;
+
+static void record(std::vector<uint8_t>& delta, uint8_t op, uint32_t offset,
+                   uint32_t len)
+{
+    uint8_t header[9];
+
+    offset = htole32(offset);
+    len = htole32(len);
+
+    header[0] = op;
+    std::memcpy(&header[1], &offset, sizeof(offset));
+    std::memcpy(&header[5], &len, sizeof(len));
+    delta.insert(delta.end(), header, header + sizeof(header));
+}
+
+TEST(DeltaParse, Empty)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    EXPECT_EQ(HIOMAP_CC_OK, hiomap_delta_parse(delta, FLASH_SIZE, ops));
+    EXPECT_TRUE(ops.empty());
+}
+
+TEST(DeltaParse, Records)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_DATA, 0x1000, 3);
+    delta.insert(delta.end(), {0xaa, 0xbb, 0xcc});
+    record(delta, HIOMAP_DELTA_FILL, 0x2000, 0x10000);
+    delta.push_back(0x00);
+    /* Covers no flash, so yields no operation */
+    record(delta, HIOMAP_DELTA_DATA, 0x3000, 0);
+
+    ASSERT_EQ(HIOMAP_CC_OK, hiomap_delta_parse(delta, FLASH_SIZE, ops));
+    ASSERT_EQ(2u, ops.size());
+
+    EXPECT_EQ(0x1000u, ops[0].offset);
+    EXPECT_EQ(3u, ops[0].len);
+    ASSERT_NE(nullptr, ops[0].data);
+    EXPECT_EQ(0, std::memcmp(ops[0].data, "\xaa\xbb\xcc", 3));
+
+    EXPECT_EQ(0x2000u, ops[1].offset);
+    EXPECT_EQ(0x10000u, ops[1].len);
+    EXPECT_EQ(nullptr, ops[1].data);
+    EXPECT_EQ(0x00, ops[1].fill);
+}
+
+TEST(DeltaParse, RecordEndingAtFlashEnd)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, FLASH_SIZE - 0x1000, 0x1000);
+    delta.push_back(0xff);
+
+    EXPECT_EQ(HIOMAP_CC_OK, hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, TruncatedHeader)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, 0, 1);
+    delta.pop_back();
+
+    EXPECT_EQ(HIOMAP_CC_REQ_DATA_LEN_INVALID,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, TruncatedData)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_DATA, 0, 4);
+    delta.insert(delta.end(), {0x01, 0x02, 0x03});
+
+    EXPECT_EQ(HIOMAP_CC_REQ_DATA_LEN_INVALID,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, MissingFillByte)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, 0, 0x1000);
+
+    EXPECT_EQ(HIOMAP_CC_REQ_DATA_LEN_INVALID,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, RecordTooLong)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, 0, HIOMAP_DELTA_RECORD_MAX + 1);
+    delta.push_back(0xff);
+
+    EXPECT_EQ(HIOMAP_CC_PARM_OUT_OF_RANGE,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, OffsetPastFlash)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, FLASH_SIZE + 1, 0);
+    delta.push_back(0xff);
+
+    EXPECT_EQ(HIOMAP_CC_PARM_OUT_OF_RANGE,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
+
+TEST(DeltaParse, LengthPastFlash)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, HIOMAP_DELTA_FILL, FLASH_SIZE - 0x1000, 0x1001);
+    delta.push_back(0xff);
+    EXPECT_EQ(HIOMAP_CC_PARM_OUT_OF_RANGE,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+
+    /* An offset and length whose sum wraps must not slip through */
+    delta.clear();
+    record(delta, HIOMAP_DELTA_FILL, UINT32_MAX - 0xfff, 0x2000);
+    delta.push_back(0xff);
+    EXPECT_EQ(HIOMAP_CC_PARM_OUT_OF_RANGE,
+              hiomap_delta_parse(delta, UINT32_MAX, ops));
+}
+
+TEST(DeltaParse, UnknownOp)
+{
+    std::vector<uint8_t> delta;
+    std::vector<struct hiomap_backend_op> ops;
+
+    record(delta, 0x7f, 0, 1);
+    delta.push_back(0xff);
+
+    EXPECT_EQ(HIOMAP_CC_INVALID_FIELD_REQUEST,
+              hiomap_delta_parse(delta, FLASH_SIZE, ops));
+}
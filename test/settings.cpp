@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "settings.hpp"
+
+#include <cerrno>
+
+#include <gtest/gtest.h>
+
+using namespace openpower::flash;
+
+TEST(SettingsAssign, Value)
+{
+    struct hiomap_settings settings;
+
+    ASSERT_EQ(0, hiomap_settings_assign(&settings, "PipelineDepth=8"));
+    EXPECT_EQ(8u, settings.pipeline_depth);
+
+    ASSERT_EQ(0, hiomap_settings_assign(&settings, "WindowInflateSize=0x2000"));
+    EXPECT_EQ(0x2000u, settings.window_inflate_size);
+}
+
+TEST(SettingsAssign, Malformed)
+{
+    struct hiomap_settings settings;
+
+    EXPECT_EQ(-EINVAL, hiomap_settings_assign(&settings, "PipelineDepth"));
+    EXPECT_EQ(-ENOENT, hiomap_settings_assign(&settings, "NoSuchSetting=1"));
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "PipelineDepth="));
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "PipelineDepth=8x"));
+}
+
+TEST(SettingsAssign, OutOfRange)
+{
+    struct hiomap_settings settings;
+
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "PipelineDepth=65"));
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "TimeoutMin=0"));
+    EXPECT_EQ(0u, settings.pipeline_depth);
+}
+
+TEST(SettingsValid, TimeoutBounds)
+{
+    struct hiomap_settings settings;
+
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "TimeoutMin=61"));
+    EXPECT_EQ(2u, settings.timeout_min);
+
+    ASSERT_EQ(0, hiomap_settings_assign(&settings, "TimeoutMin=60"));
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "TimeoutMax=59"));
+}
+
+TEST(SettingsValid, IdleFlushMinWithinDelay)
+{
+    struct hiomap_settings settings;
+
+    EXPECT_EQ(-ERANGE, hiomap_settings_assign(&settings, "IdleFlushMin=201"));
+    EXPECT_EQ(20u, settings.idle_flush_min);
+
+    ASSERT_EQ(0, hiomap_settings_assign(&settings, "IdleFlushMin=200"));
+    EXPECT_EQ(-ERANGE,
+              hiomap_settings_assign(&settings, "IdleFlushDelay=199"));
+    ASSERT_EQ(0, hiomap_settings_assign(&settings, "IdleFlushDelay=200"));
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "stats.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace openpower::flash;
+
+static void record(struct hiomap_histogram* hist, uint64_t us, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        hiomap_histogram_record(hist, us);
+    }
+}
+
+TEST(HistogramQuantile, Empty)
+{
+    struct hiomap_histogram hist = {};
+
+    EXPECT_EQ(0u, hiomap_histogram_quantile(&hist, 0.5));
+}
+
+TEST(HistogramQuantile, InterpolatesWithinBucket)
+{
+    struct hiomap_histogram hist = {};
+
+    /* All in the 250-500us bucket */
+    record(&hist, 300, 100);
+
+    EXPECT_EQ(375u, hiomap_histogram_quantile(&hist, 0.5));
+    EXPECT_EQ(500u, hiomap_histogram_quantile(&hist, 1.0));
+}
+
+TEST(HistogramQuantile, SpansBuckets)
+{
+    struct hiomap_histogram hist = {};
+
+    record(&hist, 50, 90);
+    record(&hist, 2000, 10);
+
+    EXPECT_EQ(55u, hiomap_histogram_quantile(&hist, 0.5));
+    /* Nine tenths of the way through the 1000-2500us bucket */
+    EXPECT_EQ(2350u, hiomap_histogram_quantile(&hist, 0.99));
+}
+
+TEST(HistogramQuantile, BeyondLastBound)
+{
+    struct hiomap_histogram hist = {};
+    uint64_t last = hiomap_latency_bounds_us.back();
+
+    record(&hist, last + 1, 4);
+
+    EXPECT_EQ(2 * last, hiomap_histogram_quantile(&hist, 0.99));
+}
+
+TEST(HistogramDecay, HalvesBucketsAndScalesSum)
+{
+    struct hiomap_histogram hist = {};
+
+    record(&hist, 50, 10);
+    record(&hist, 200, 3);
+    ASSERT_EQ(13u, hist.count);
+    ASSERT_EQ(1100u, hist.sum_us);
+
+    hiomap_histogram_decay(&hist);
+
+    EXPECT_EQ(5u, hist.buckets[0]);
+    EXPECT_EQ(1u, hist.buckets[1]);
+    EXPECT_EQ(6u, hist.count);
+    EXPECT_EQ(1100u * 6 / 13, hist.sum_us);
+}
+
+TEST(HistogramDecay, Empty)
+{
+    struct hiomap_histogram hist = {};
+
+    hiomap_histogram_decay(&hist);
+
+    EXPECT_EQ(0u, hist.count);
+    EXPECT_EQ(0u, hist.sum_us);
+}
+
+TEST(HistogramDecay, FavoursRecentSamples)
+{
+    struct hiomap_histogram hist = {};
+
+    /* An old run of slow write-backs, then as many fast ones */
+    record(&hist, 50000, 64);
+    hiomap_histogram_decay(&hist);
+    hiomap_histogram_decay(&hist);
+    record(&hist, 2000, 64);
+
+    EXPECT_LE(hiomap_histogram_quantile(&hist, 0.5), 2500u);
+}
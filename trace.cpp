@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2018 IBM Corp.
+
+#include "config.h"
+
+#include "trace.hpp"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <string>
+
+namespace openpower
+{
+namespace flash
+{
+
+int hiomap_trace_open(struct hiomap_trace* trace, const char* path,
+                      uint64_t now_us)
+{
+    hiomap_trace_close(trace);
+
+    /* As for the statistics export, the directory may be on tmpfs */
+    std::string dir(path);
+    mkdir(dirname(&dir[0]), 0755);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    /* A trace left by an older build may have been readable by others */
+    if (fchmod(fd, 0600) < 0 || !(trace->file = fdopen(fd, "w")))
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    trace->start_us = now_us;
+    trace->bytes = fprintf(trace->file, HIOMAP_TRACE_HEADER "\n");
+
+    return 0;
+}
+
+void hiomap_trace_close(struct hiomap_trace* trace)
+{
+    if (trace->file)
+    {
+        fclose(trace->file);
+        trace->file = nullptr;
+    }
+}
+
+static int hiomap_trace_hex(FILE* file, const uint8_t* buf, size_t len)
+{
+    int written = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        written += fprintf(file, "%02x", buf[i]);
+    }
+
+    return written;
+}
+
+int hiomap_trace_record(struct hiomap_trace* trace, uint64_t arrival_us,
+                        uint64_t service_us, int cc, const uint8_t* req,
+                        size_t req_len, const uint8_t* resp, size_t resp_len)
+{
+    FILE* file = trace->file;
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    if (trace->bytes >= HIOMAP_TRACE_MAX)
+    {
+        hiomap_trace_close(trace);
+        return 0;
+    }
+
+    trace->bytes += fprintf(file, "%" PRIu64 " %" PRIu64 " %02x ",
+                            arrival_us - trace->start_us, service_us, cc);
+    trace->bytes += hiomap_trace_hex(file, req, req_len);
+    if (resp_len)
+    {
+        trace->bytes += fprintf(file, " ");
+        trace->bytes += hiomap_trace_hex(file, resp, resp_len);
+    }
+    trace->bytes += fprintf(file, "\n");
+
+    /* Push each record out so a crash loses at most the one in flight */
+    if (fflush(file) == EOF || ferror(file))
+    {
+        hiomap_trace_close(trace);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static bool hiomap_trace_unhex(const char* hex, std::vector<uint8_t>& buf)
+{
+    size_t len = strlen(hex);
+
+    if (len % 2)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i += 2)
+    {
+        unsigned int byte;
+
+        if (sscanf(&hex[i], "%2x", &byte) != 1)
+        {
+            return false;
+        }
+
+        buf.push_back(byte);
+    }
+
+    return true;
+}
+
+int hiomap_trace_load(const char* path,
+                      std::vector<struct hiomap_trace_entry>& entries)
+{
+    char line[2 * 4096 * 2 + 128];
+
+    FILE* file = fopen(path, "re");
+    if (!file)
+    {
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        struct hiomap_trace_entry entry;
+        char req[2 * 4096 + 1];
+        char resp[2 * 4096 + 1] = "";
+        unsigned int cc;
+
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        int n = sscanf(line, "%" SCNu64 " %" SCNu64 " %x %8192s %8192s",
+                       &entry.arrival_us, &entry.service_us, &cc, req, resp);
+        if (n < 4 || !hiomap_trace_unhex(req, entry.req) ||
+            !hiomap_trace_unhex(resp, entry.resp) || entry.req.size() < 2)
+        {
+            fclose(file);
+            return -EINVAL;
+        }
+
+        entry.cc = cc;
+        entries.push_back(std::move(entry));
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+} // namespace flash
+} // namespace openpower
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2018 IBM Corp. */
+
+#ifndef HIOMAP_TRACE_H
+#define HIOMAP_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace openpower
+{
+namespace flash
+{
+
+/*
+ * A record of the requests the provider handled, for replaying through
+ * hiomap-sim. Each line is
+ *
+ *   ARRIVAL_US SERVICE_US CC REQUEST [RESPONSE]
+ *
+ * with the request and response in hex as they would be passed to and from
+ * hiomap_handle(). Arrival times count from when tracing started.
+ */
+#define HIOMAP_TRACE_HEADER "# hiomap trace v1"
+
+/* Tracing stops once the file reaches this size */
+#define HIOMAP_TRACE_MAX (16 << 20)
+
+struct hiomap_trace
+{
+    FILE* file;
+    uint64_t start_us;
+    size_t bytes;
+};
+
+struct hiomap_trace_entry
+{
+    uint64_t arrival_us;
+    uint64_t service_us;
+    int cc;
+    std::vector<uint8_t> req;
+    std::vector<uint8_t> resp;
+};
+
+/*
+ * Start a new trace at path, readable only by its owner as it holds flash
+ * contents. Returns 0 on success or a negative errno.
+ */
+int hiomap_trace_open(struct hiomap_trace* trace, const char* path,
+                      uint64_t now_us);
+
+void hiomap_trace_close(struct hiomap_trace* trace);
+
+static inline bool hiomap_trace_active(const struct hiomap_trace* trace)
+{
+    return trace->file;
+}
+
+/*
+ * Append a request to the trace. Tracing stops at HIOMAP_TRACE_MAX, or on an
+ * error, which is returned as a negative errno.
+ */
+int hiomap_trace_record(struct hiomap_trace* trace, uint64_t arrival_us,
+                        uint64_t service_us, int cc, const uint8_t* req,
+                        size_t req_len, const uint8_t* resp, size_t resp_len);
+
+/* Returns 0 on success or a negative errno */
+int hiomap_trace_load(const char* path,
+                      std::vector<struct hiomap_trace_entry>& entries);
+
+} // namespace flash
+} // namespace openpower
+
+#endif /* HIOMAP_TRACE_H */